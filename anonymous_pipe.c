@@ -1,132 +1,395 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
-#include <stdbool.h>
+/*
+ * Pipe throughput and latency benchmark.
+ *
+ * A parent and a forked child exchange data over anonymous pipes or a
+ * socketpair, the way the shell's pipelines connect their commands:
+ *
+ *   pipe        pipe(), write() and read()
+ *   pipe-setsz  the same with the pipes grown to pipe-max-size
+ *               (F_SETPIPE_SZ) so a whole buffer fits
+ *   vmsplice    grown pipes, vmsplice() of the buffer and read()
+ *   splice      grown pipes, vmsplice() and splice() to /dev/null, so
+ *               the data is never copied
+ *   socketpair  AF_UNIX stream socketpair(), write() and read()
+ *
+ * For every method and buffer size, the parent sends a total amount of
+ * data (throughput, until the child acknowledges the last byte), then
+ * bounces messages of the buffer size off the child (latency, one round
+ * trip each). One CSV line is printed per run:
+ *
+ *   method,size,bytes,seconds,bytes_per_sec,round_trips,rtt_mean_us,
+ *   rtt_p50_us,rtt_p99_us
+ *
+ * Build it with `make -C src pipe-bench`.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+
+#include <fcntl.h>
+#include <getopt.h>
 #include <unistd.h>
 
-#include "utils/utils.h"
+#include "src/utils.h"
+
+#define DEFAULT_SIZES		"128,4096,65536,1048576"
+#define DEFAULT_METHODS		"pipe,pipe-setsz,vmsplice,splice,socketpair"
+#define DEFAULT_TOTAL		(256 << 20)
+#define DEFAULT_ROUNDS		10000
+/* Round trips are also bounded by the total, with at least this many. */
+#define MIN_ROUNDS		100
+
+#define PIPE_MAX_SIZE		"/proc/sys/fs/pipe-max-size"
 
-#define BUFSIZE 	128
-#define EXIT_STR	"exit"
-#define PIPE_READ	0
-#define PIPE_WRITE	1
+enum method {
+	METHOD_PIPE,
+	METHOD_PIPE_SETSZ,
+	METHOD_VMSPLICE,
+	METHOD_SPLICE,
+	METHOD_SOCKETPAIR,
+	NR_METHODS
+};
+
+static const char * const method_names[NR_METHODS] = {
+	[METHOD_PIPE] = "pipe",
+	[METHOD_PIPE_SETSZ] = "pipe-setsz",
+	[METHOD_VMSPLICE] = "vmsplice",
+	[METHOD_SPLICE] = "splice",
+	[METHOD_SOCKETPAIR] = "socketpair",
+};
+
+/* Ends of the two directions, as seen by the parent and by the child. */
+struct channel {
+	int parent_in, parent_out;
+	int child_in, child_out;
+};
+
+struct result {
+	double seconds;
+	size_t rounds;
+	double rtt_mean_us;
+	double rtt_p50_us;
+	double rtt_p99_us;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int find_method(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NR_METHODS; i++)
+		if (strcmp(name, method_names[i]) == 0)
+			return i;
+
+	return -1;
+}
+
+static bool grows_pipes(enum method m)
+{
+	return m == METHOD_PIPE_SETSZ || m == METHOD_VMSPLICE ||
+	       m == METHOD_SPLICE;
+}
 
-static bool check_for_exit(const char *input)
+static void grow_pipe(int fd)
 {
-	if (strcmp(input, EXIT_STR) == 0 || strlen(input) == 0)
-	{
-		return true;
+	char buf[32];
+	long size;
+	int max;
+
+	max = open(PIPE_MAX_SIZE, O_RDONLY | O_CLOEXEC);
+	if (max < 0)
+		return;
+	size = read(max, buf, sizeof(buf) - 1);
+	close(max);
+	if (size <= 0)
+		return;
+	buf[size] = '\0';
+
+	/* Unprivileged users may be refused, the default size stays. */
+	fcntl(fd, F_SETPIPE_SZ, strtol(buf, NULL, 10));
+}
+
+static void open_channel(enum method m, struct channel *c)
+{
+	int down[2], up[2];
+
+	if (m == METHOD_SOCKETPAIR) {
+		DIE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, down) < 0,
+		    "socketpair");
+		c->parent_in = c->parent_out = down[0];
+		c->child_in = c->child_out = down[1];
+		return;
 	}
 
-	return false;
+	DIE(pipe2(down, O_CLOEXEC) < 0, "pipe2");
+	DIE(pipe2(up, O_CLOEXEC) < 0, "pipe2");
+	if (grows_pipes(m)) {
+		grow_pipe(down[PIPE_WRITE]);
+		grow_pipe(up[PIPE_WRITE]);
+	}
+
+	c->parent_out = down[PIPE_WRITE];
+	c->child_in = down[PIPE_READ];
+	c->child_out = up[PIPE_WRITE];
+	c->parent_in = up[PIPE_READ];
 }
 
-static void child_loop(int readfd)
+/**
+ * Close the ends the other process uses; each end is closed once, the
+ * two ends of a socket are the same descriptor.
+ */
+static void close_ends(int in, int out)
 {
-	char output[BUFSIZE];
-	int rc;
-
-	while (1)
-	{
-		rc = read(readfd, output, BUFSIZE);
-		DIE(rc < 0, "read");
-
-		if (rc == 0)
-		{
-			/* TODO: Close pipe head used for reading. */
-			close(readfd);
-			break;
+	close(in);
+	if (out != in)
+		close(out);
+}
+
+static void send_all(enum method m, int fd, const char *buf, size_t len)
+{
+	struct iovec iov;
+	ssize_t rc;
+
+	while (len > 0) {
+		if (m == METHOD_VMSPLICE || m == METHOD_SPLICE) {
+			/* The buffer is never written, the pages may be shared. */
+			iov.iov_base = (void *)buf;
+			iov.iov_len = len;
+			rc = vmsplice(fd, &iov, 1, 0);
+		} else {
+			rc = write(fd, buf, len);
 		}
+		if (rc < 0 && errno == EINTR)
+			continue;
+		DIE(rc <= 0, method_names[m]);
 
-		printf("[Child received]: %s\n", output);
-		fflush(stdout);
+		buf += rc;
+		len -= rc;
 	}
+}
 
-	return;
+static void receive_all(enum method m, int fd, char *buf, size_t len,
+			int null_fd)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		if (m == METHOD_SPLICE)
+			rc = splice(fd, NULL, null_fd, NULL, len, SPLICE_F_MOVE);
+		else
+			rc = read(fd, buf, len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		DIE(rc <= 0, method_names[m]);
+
+		len -= rc;
+	}
 }
 
-static void parent_loop(int writefd)
+/**
+ * The child: take `total` bytes and acknowledge them, then echo `rounds`
+ * messages.
+ */
+static void child_run(enum method m, struct channel *c, char *buf,
+		      size_t size, size_t total, size_t rounds)
 {
-	char input[BUFSIZE];
-	int rc;
-
-	while (1)
-	{
-		memset(input, 0, BUFSIZE);
-		fgets(input, BUFSIZE, stdin);
-		// Remove trailing newline
-		if (input[strlen(input) - 1] == '\n')
-			input[strlen(input) - 1] = '\0';
-
-		if (check_for_exit(input))
-		{
-			/* TODO: Close pipe head used for writing. */
-			close(writefd);
-			break;
-		}
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	size_t left, chunk, i;
+	char ack = 0;
+
+	DIE(null_fd < 0, "open");
 
-		rc = write(writefd, input, BUFSIZE);
-		DIE(rc < 0, "write");
+	for (left = total; left > 0; left -= chunk) {
+		chunk = left < size ? left : size;
+		receive_all(m, c->child_in, buf, chunk, null_fd);
 	}
+	DIE(write(c->child_out, &ack, 1) != 1, "write");
 
-	return;
+	for (i = 0; i < rounds; i++) {
+		receive_all(m, c->child_in, buf, size, null_fd);
+		send_all(m, c->child_out, buf, size);
+	}
+
+	exit(EXIT_SUCCESS);
 }
 
-static void wait_for_input(const char *msg)
+static int compare_u64(const void *a, const void *b)
 {
-	char buf[32];
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
 
-	fprintf(stderr, " * %s\n", msg);
-	fprintf(stderr, " -- Press ENTER to continue ...");
-	fgets(buf, 32, stdin);
+	return x < y ? -1 : x > y;
 }
 
-int main(void)
+static void parent_run(enum method m, struct channel *c, char *buf,
+		       size_t size, size_t total, struct result *r)
 {
-	pid_t pid;
-	int rc;
-	int pipe_des[2];
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	size_t left, chunk, i;
+	uint64_t start, sum = 0;
+	uint64_t *rtt;
+	char ack;
+
+	DIE(null_fd < 0, "open");
+
+	start = now_ns();
+	for (left = total; left > 0; left -= chunk) {
+		chunk = left < size ? left : size;
+		send_all(m, c->parent_out, buf, chunk);
+	}
+	DIE(read(c->parent_in, &ack, 1) != 1, "read");
+	r->seconds = (now_ns() - start) / 1e9;
+
+	rtt = malloc(r->rounds * sizeof(*rtt));
+	DIE(rtt == NULL, "malloc");
 
-	rc = pipe(pipe_des);
-	DIE(rc < 0, "pipe");
+	for (i = 0; i < r->rounds; i++) {
+		start = now_ns();
+		send_all(m, c->parent_out, buf, size);
+		receive_all(m, c->parent_in, buf, size, null_fd);
+		rtt[i] = now_ns() - start;
+		sum += rtt[i];
+	}
+
+	qsort(rtt, r->rounds, sizeof(*rtt), compare_u64);
+	r->rtt_mean_us = sum / 1e3 / r->rounds;
+	r->rtt_p50_us = rtt[r->rounds / 2] / 1e3;
+	r->rtt_p99_us = rtt[r->rounds * 99 / 100] / 1e3;
+
+	free(rtt);
+	close(null_fd);
+}
+
+static void run(enum method m, size_t size, size_t total, size_t rounds)
+{
+	struct result r = { .rounds = rounds };
+	struct channel c;
+	char *buf;
+	pid_t pid;
 
-	printf("pipe_des[0] = %d; pipe_des[1] = %d\n", pipe_des[PIPE_READ], pipe_des[PIPE_WRITE]);
+	/* Page aligned, as vmsplice() moves whole pages best. */
+	DIE(posix_memalign((void **)&buf, sysconf(_SC_PAGESIZE), size) != 0,
+	    "posix_memalign");
+	memset(buf, 'x', size);
 
-	wait_for_input("pipe created");
+	open_channel(m, &c);
 
 	pid = fork();
-	switch (pid)
-	{
-		case -1: /* Fork failed, cleaning up. */
-			/* TODO: Close both heads of the pipe. */
-			close(pipe_des[PIPE_READ]);
-			close(pipe_des[PIPE_WRITE]);
-			DIE(pid, "fork");
-			return EXIT_FAILURE;
+	DIE(pid < 0, "fork");
+	if (pid == 0) {
+		close_ends(c.parent_in, c.parent_out);
+		child_run(m, &c, buf, size, total, rounds);
+	}
 
-		case 0: /* Child process. */
-			/* TODO: Close unused pipe head by child. */
-			close(pipe_des[PIPE_WRITE]);
+	close_ends(c.child_in, c.child_out);
+	parent_run(m, &c, buf, size, total, &r);
+	close_ends(c.parent_in, c.parent_out);
+	DIE(waitpid(pid, NULL, 0) < 0, "waitpid");
 
-			/* TODO: Call child loop and pass pipe head used for reading. */
-			child_loop(pipe_des[PIPE_READ]);
-			break;
+	printf("%s,%zu,%zu,%.6f,%.0f,%zu,%.3f,%.3f,%.3f\n", method_names[m],
+	       size, total, r.seconds, total / r.seconds, r.rounds,
+	       r.rtt_mean_us, r.rtt_p50_us, r.rtt_p99_us);
+	fflush(stdout);
 
-		default: /* Parent process. */
-			/* TODO: Close unused pipe head by parent. */
-			close(pipe_des[PIPE_READ]);
+	free(buf);
+}
 
-			/* TODO: Call parent loop and pass pipe head used for writing. */
-			parent_loop(pipe_des[PIPE_WRITE]);
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-m METHOD,...] [-s SIZE,...] [-t TOTAL] [-n ROUNDS]\n"
+		"Methods: %s\n"
+		"Sizes take K, M and G suffixes; defaults: -s %s -t 256M -n %d\n",
+		name, DEFAULT_METHODS, DEFAULT_SIZES, DEFAULT_ROUNDS);
+}
+
+int main(int argc, char *argv[])
+{
+	char *methods = strdup(DEFAULT_METHODS), *sizes = strdup(DEFAULT_SIZES);
+	size_t total = DEFAULT_TOTAL, rounds = DEFAULT_ROUNDS, size, n;
+	char *method, *size_str, *save_m, *save_s, *sizes_copy;
+	int opt, m;
 
-			/* Wait for child process to finish. */
-			wait(NULL);
+	DIE(methods == NULL || sizes == NULL, "strdup");
 
+	while ((opt = getopt(argc, argv, "m:s:t:n:")) != -1) {
+		switch (opt) {
+		case 'm':
+			free(methods);
+			methods = strdup(optarg);
+			DIE(methods == NULL, "strdup");
 			break;
+		case 's':
+			free(sizes);
+			sizes = strdup(optarg);
+			DIE(sizes == NULL, "strdup");
+			break;
+		case 't':
+			total = parse_size(optarg);
+			break;
+		case 'n':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
 	}
+	if (total == 0 || rounds == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("method,size,bytes,seconds,bytes_per_sec,round_trips,rtt_mean_us,rtt_p50_us,rtt_p99_us\n");
+	/* Or the children print it again when they exit. */
+	fflush(stdout);
+
+	for (method = strtok_r(methods, ",", &save_m); method != NULL;
+	     method = strtok_r(NULL, ",", &save_m)) {
+		m = find_method(method);
+		if (m < 0) {
+			fprintf(stderr, "Unknown method '%s'\n", method);
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		sizes_copy = strdup(sizes);
+		DIE(sizes_copy == NULL, "strdup");
+		for (size_str = strtok_r(sizes_copy, ",", &save_s); size_str != NULL;
+		     size_str = strtok_r(NULL, ",", &save_s)) {
+			size = parse_size(size_str);
+			if (size == 0) {
+				fprintf(stderr, "Invalid size '%s'\n", size_str);
+				return EXIT_FAILURE;
+			}
+
+			/* Large messages would take long to bounce that often. */
+			n = total / size > MIN_ROUNDS ? total / size : MIN_ROUNDS;
+			run(m, size, total, n < rounds ? n : rounds);
+		}
+		free(sizes_copy);
+	}
+
+	free(methods);
+	free(sizes);
 
-	return 0;
+	return EXIT_SUCCESS;
 }
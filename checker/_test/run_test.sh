@@ -11,7 +11,6 @@ MAIN_TEST_DIR="_test/outputs"
 INPUT_DIR="_test/inputs"
 REFS_DIR="_test/refs"
 LOG_FILE="/dev/null"
-export max_points=100
 TEST_TIMEOUT=30
 
 TEST_LIB=_test/test_lib.sh
@@ -234,8 +233,35 @@ test_fun_array=(								\
 	test_common_alt		"Testing sleep command"			7	\
 	test_common_alt		"Testing fscanf function"		7	\
 	test_exec_failed	"Testing unknown command"		4	\
+	test_common		"Testing pathname expansion"		5	\
+	test_exec_failed	"Testing parallel builtin"		5	\
+	test_common		"Testing loops"				5	\
+	test_common		"Testing arithmetic expansion"		5	\
+	test_exec_failed	"Testing stats builtin"			5	\
+	test_exec_failed	"Testing explain mode"			5	\
+	test_exec_failed	"Testing timeout builtin"		5	\
+	test_exec_failed	"Testing output fan-out"		5	\
+	test_exec_failed	"Testing keep-order mode"		5	\
+	test_exec_failed	"Testing profiler"			5	\
+	test_exec_failed	"Testing optimizer pass"		5	\
+	test_exec_failed	"Testing memo builtin"			5	\
+	test_exec_failed	"Testing in-process pipes"		5	\
+	test_exec_failed	"Testing read builtin"			5	\
+	test_exec_failed	"Testing command lists"			5	\
+	test_exec_failed	"Testing sched builtin"			5	\
+	test_exec_failed	"Testing pipe meter"			5	\
+	test_exec_failed	"Testing server mode"			5	\
+	test_exec_failed	"Testing script cache"			5	\
+	test_exec_failed	"Testing argument batches"		5	\
 )
 
+# The total is the sum of the points of the tests.
+max_points=0
+for ((i = 2; i < ${#test_fun_array[@]}; i += 3)); do
+	max_points=$((max_points + test_fun_array[i]))
+done
+export max_points
+
 # ----------------- Run test ------------------------------------------------- #
 
 # First we check if we have everything defined.
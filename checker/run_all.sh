@@ -2,7 +2,7 @@
 # SPDX-License-Identifier: BSD-3-Clause
 
 first_test=0
-last_test=18
+last_test=38
 script=./_test/run_test.sh
 
 # Call init to set up testing environment.
@@ -18,14 +18,16 @@ done | tee results.txt
 grep -a '\[.*\]$' results.txt | awk -F '[] /[]+' '
 BEGIN {
     sum=0
+    max=0
 }
 
 {
 	sum += $(NF-2);
+	max = $(NF-1);
 }
 
 END {
-    printf "\n%66s  [%02d/100]\n", "Total:", sum;
+    printf "\n%66s  [%02d/%02d]\n", "Total:", sum, max;
 }'
 
 # Cleanup testing environment.
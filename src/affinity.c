@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <linux/ioprio.h>
+#include <linux/mempolicy.h>
+
+#include <unistd.h>
+
+#include "affinity.h"
+#include "utils.h"
+
+#define NODE_CPULIST		"/sys/devices/system/node/node%d/cpulist"
+
+/* Level of the realtime and best-effort I/O classes when not given. */
+#define IOPRIO_LEVEL		4
+#define IOPRIO_LEVELS		8
+
+#define WORD_BITS		(sizeof(unsigned long) * CHAR_BIT)
+
+/* Shared by the processes of the shell, so that nested jobs take turns. */
+static unsigned int *spread_next;
+static cpu_set_t spread_cpus;
+
+static void set_bit(unsigned long *words, int bit)
+{
+	words[bit / WORD_BITS] |= 1UL << (bit % WORD_BITS);
+}
+
+static bool test_bit(const unsigned long *words, int bit)
+{
+	return words[bit / WORD_BITS] & (1UL << (bit % WORD_BITS));
+}
+
+static bool parse_int(const char *str, int min, int max, int *value)
+{
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(str, &end, 10);
+	if (end == str || *end != '\0' || errno != 0 || n < min || n > max)
+		return false;
+
+	*value = n;
+	return true;
+}
+
+/**
+ * Parse a CPU list like 0-3,8,10-11 into `words`.
+ */
+static bool parse_cpus(const char *str, unsigned long *words)
+{
+	long first, last;
+	char *end;
+
+	memset(words, 0, SCHED_CPU_WORDS * sizeof(*words));
+
+	for (;;) {
+		first = strtol(str, &end, 10);
+		if (end == str || first < 0)
+			return false;
+
+		last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str)
+				return false;
+		}
+		if (last < first || last >= SCHED_MAX_CPUS)
+			return false;
+
+		for (; first <= last; first++)
+			set_bit(words, first);
+
+		if (*end != ',')
+			return *end == '\0';
+		str = end + 1;
+	}
+}
+
+/**
+ * Store the CPUs of the NUMA node `node` in `words`.
+ */
+static bool node_cpus(int node, unsigned long *words)
+{
+	char path[64], list[4096];
+	FILE *file;
+	bool ok;
+
+	snprintf(path, sizeof(path), NODE_CPULIST, node);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return false;
+
+	ok = fgets(list, sizeof(list), file) != NULL;
+	fclose(file);
+	if (!ok)
+		return false;
+
+	list[strcspn(list, "\n")] = '\0';
+	return parse_cpus(list, words);
+}
+
+static bool parse_ioprio(const char *str, int *ioprio)
+{
+	static const char * const classes[] = {
+		[IOPRIO_CLASS_RT] = "realtime",
+		[IOPRIO_CLASS_BE] = "best-effort",
+		[IOPRIO_CLASS_IDLE] = "idle",
+	};
+	const char *colon = strchr(str, ':');
+	size_t len = colon != NULL ? (size_t)(colon - str) : strlen(str);
+	int class, level = IOPRIO_LEVEL;
+
+	for (class = IOPRIO_CLASS_RT; class <= IOPRIO_CLASS_IDLE; class++)
+		if ((strlen(classes[class]) == len &&
+		     strncmp(str, classes[class], len) == 0) ||
+		    (len == 1 && *str == '0' + class))
+			break;
+	if (class > IOPRIO_CLASS_IDLE)
+		return false;
+
+	if (colon != NULL &&
+	    (class == IOPRIO_CLASS_IDLE ||
+	     !parse_int(colon + 1, 0, IOPRIO_LEVELS - 1, &level)))
+		return false;
+	if (class == IOPRIO_CLASS_IDLE)
+		level = 0;
+
+	*ioprio = IOPRIO_PRIO_VALUE(class, level);
+	return true;
+}
+
+static bool parse_policy(const char *str, int *policy)
+{
+	if (strcmp(str, "batch") == 0)
+		*policy = SCHED_BATCH;
+	else if (strcmp(str, "idle") == 0)
+		*policy = SCHED_IDLE;
+	else
+		return false;
+
+	return true;
+}
+
+static bool parse_option(const char *option, const char *value,
+			 struct sched_settings *s)
+{
+	if (strcmp(option, "-c") == 0) {
+		s->has_cpus = parse_cpus(value, s->cpus);
+		return s->has_cpus;
+	}
+
+	if (strcmp(option, "-m") == 0) {
+		if (!parse_int(value, 0, WORD_BITS - 1, &s->node))
+			return false;
+		/* The CPUs of the node, unless some are given. */
+		if (!s->has_cpus)
+			s->has_cpus = node_cpus(s->node, s->cpus);
+		return s->has_cpus;
+	}
+
+	if (strcmp(option, "-n") == 0) {
+		s->has_nice = parse_int(value, -20, 19, &s->nice);
+		return s->has_nice;
+	}
+
+	if (strcmp(option, "-i") == 0)
+		return parse_ioprio(value, &s->ioprio);
+
+	if (strcmp(option, "-p") == 0)
+		return parse_policy(value, &s->policy);
+
+	return false;
+}
+
+word_t *sched_parse(word_t *params, struct sched_settings *s)
+{
+	char *option, *value;
+	word_t *w = params;
+	bool ok = true;
+
+	while (ok && w != NULL && w->string[0] == '-' && w->next_word != NULL) {
+		option = get_word(w);
+		value = get_word(w->next_word);
+		ok = parse_option(option, value, s);
+		if (!ok)
+			fprintf(stderr, "sched: invalid %s '%s'\n", option, value);
+		free(option);
+		free(value);
+		w = w->next_word->next_word;
+	}
+
+	return ok ? w : NULL;
+}
+
+static void to_cpu_set(const unsigned long *words, cpu_set_t *set)
+{
+	int cpu;
+
+	CPU_ZERO(set);
+	for (cpu = 0; cpu < SCHED_MAX_CPUS; cpu++)
+		if (test_bit(words, cpu))
+			CPU_SET(cpu, set);
+}
+
+static void check(int ret, const char *what)
+{
+	if (ret < 0) {
+		fprintf(stderr, "sched: %s: %s\n", what, strerror(errno));
+		exit(SCHED_USAGE);
+	}
+}
+
+void sched_apply(const struct sched_settings *s)
+{
+	unsigned long nodes = 0;
+	struct sched_param param;
+	cpu_set_t set;
+
+	if (s->node >= 0) {
+		nodes = 1UL << s->node;
+		check(syscall(SYS_set_mempolicy, MPOL_BIND, &nodes, WORD_BITS + 1),
+		      "set_mempolicy");
+	}
+
+	if (s->has_cpus) {
+		to_cpu_set(s->cpus, &set);
+		check(sched_setaffinity(0, sizeof(set), &set), "sched_setaffinity");
+	}
+
+	if (s->has_nice)
+		check(setpriority(PRIO_PROCESS, 0, s->nice), "setpriority");
+
+	if (s->ioprio != 0)
+		check(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, s->ioprio),
+		      "ioprio_set");
+
+	if (s->policy >= 0) {
+		memset(&param, 0, sizeof(param));
+		check(sched_setscheduler(0, s->policy, &param),
+		      "sched_setscheduler");
+	}
+}
+
+int sched_spread_slot(void)
+{
+	const char *value = getenv(SCHED_VAR);
+
+	if (value == NULL || strcmp(value, SCHED_SPREAD) != 0)
+		return -1;
+
+	if (spread_next == NULL) {
+		spread_next = mmap(NULL, sizeof(*spread_next), PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		DIE(spread_next == MAP_FAILED, "mmap");
+		DIE(sched_getaffinity(0, sizeof(spread_cpus), &spread_cpus) < 0,
+		    "sched_getaffinity");
+	}
+
+	return __atomic_fetch_add(spread_next, 1, __ATOMIC_RELAXED);
+}
+
+void sched_spread_pin(int slot)
+{
+	int skip, cpu;
+	cpu_set_t set;
+
+	if (slot < 0 || CPU_COUNT(&spread_cpus) == 0)
+		return;
+
+	/* The slot-th CPU of the shell, round robin. */
+	skip = slot % CPU_COUNT(&spread_cpus);
+	for (cpu = 0; !CPU_ISSET(cpu, &spread_cpus) || skip-- > 0; cpu++)
+		;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+#include <limits.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Scheduling settings of the sched internal command:
+ *   sched [-c CPUS] [-m NODE] [-n NICE] [-i CLASS[:LEVEL]] [-p POLICY]
+ *         COMMAND [ARG]...
+ *
+ * The external command runs with the settings, applied in the child just
+ * before the exec:
+ *
+ *  -c CPUS            the CPUs it may run on, a list like 0-3,8,10-11
+ *  -m NODE            the NUMA node its memory comes from; its CPUs too,
+ *                     without -c
+ *  -n NICE            its nice value, from -20 to 19
+ *  -i CLASS[:LEVEL]   its I/O priority, CLASS being realtime, best-effort
+ *                     or idle (or 1 to 3 as for ionice) and LEVEL 0 to 7
+ *  -p POLICY          batch or idle, the SCHED_BATCH or SCHED_IDLE policy
+ *
+ * sched commands nest, the inner settings adding to the outer ones.
+ * Internal commands and assignments run without the settings.
+ *
+ * With MINISHELL_SCHED=spread, each job of a & list and each stage of a
+ * pipeline is pinned to the next CPU the shell may run on, in turn, so
+ * that the jobs do not migrate nor share a CPU while there are enough.
+ * The settings of sched apply after, so -c takes precedence.
+ */
+
+#define SCHED_USAGE		125
+
+/* Like cpu_set_t, which needs _GNU_SOURCE. */
+#define SCHED_MAX_CPUS		1024
+#define SCHED_CPU_WORDS		(SCHED_MAX_CPUS / (sizeof(unsigned long) * CHAR_BIT))
+
+#define SCHED_VAR		"MINISHELL_SCHED"
+#define SCHED_SPREAD		"spread"
+
+struct sched_settings {
+	unsigned long cpus[SCHED_CPU_WORDS];
+	bool has_cpus;
+	int node;		/* -1 if any */
+	int nice;
+	bool has_nice;
+	int ioprio;		/* 0 if unchanged */
+	int policy;		/* -1 if unchanged */
+};
+
+/* Settings changing nothing, for the commands run outside of sched. */
+#define SCHED_SETTINGS_INIT	{ .node = -1, .policy = -1 }
+
+/**
+ * Add the options at the start of `params` to `s`. Returns the first word
+ * of the command, or NULL after reporting an invalid option.
+ */
+word_t *sched_parse(word_t *params, struct sched_settings *s);
+
+/**
+ * Apply `s` to the calling process, a child about to exec. Exits if that
+ * is not allowed.
+ */
+void sched_apply(const struct sched_settings *s);
+
+/**
+ * Take the next CPU for a job about to be forked, -1 when jobs are not
+ * spread. Called in the parent, so that the jobs get the CPUs in order.
+ */
+int sched_spread_slot(void);
+
+/**
+ * Pin the calling process, a job just forked, to the CPU of `slot`.
+ */
+void sched_spread_pin(int slot);
+
+#endif /* _AFFINITY_H */
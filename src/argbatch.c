@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "argbatch.h"
+#include "utils.h"
+
+#define ARGBATCH_VAR		"MINISHELL_ARG_BATCH"
+/* Room left for the auxiliary vector and the program name, like xargs. */
+#define ARG_HEADROOM		2048
+
+extern char **environ;
+
+int argbatch_jobs(void)
+{
+	const char *value = getenv(ARGBATCH_VAR);
+	long jobs;
+
+	if (value == NULL)
+		return 0;
+
+	jobs = strtol(value, NULL, 10);
+	return jobs > 0 ? jobs : 0;
+}
+
+/* Space an argument takes on the new program's stack. */
+static size_t arg_size(const char *arg)
+{
+	return strlen(arg) + 1 + sizeof(char *);
+}
+
+size_t argbatch_split(char **argv, int argc, int **starts)
+{
+	size_t limit, fixed, used, nbatches = 0, size = 16;
+	long arg_max = sysconf(_SC_ARG_MAX);
+	char **env;
+	int i;
+
+	if (arg_max <= 0)
+		return 0;
+	limit = arg_max - ARG_HEADROOM;
+
+	/* The environment, argv[0] and the two NULL terminators. */
+	fixed = arg_size(argv[0]) + 2 * sizeof(char *);
+	for (env = environ; *env != NULL; env++)
+		fixed += arg_size(*env);
+
+	used = fixed;
+	for (i = 1; i < argc; i++)
+		used += arg_size(argv[i]);
+	if (used <= limit || argc < 2)
+		return 0;
+
+	*starts = malloc(size * sizeof(**starts));
+	DIE(*starts == NULL, "malloc");
+
+	used = limit;
+	for (i = 1; i < argc; i++) {
+		/* An argument too long on its own still gets a batch. */
+		if (used + arg_size(argv[i]) > limit) {
+			if (nbatches + 2 > size) {
+				size *= 2;
+				*starts = realloc(*starts, size * sizeof(**starts));
+				DIE(*starts == NULL, "realloc");
+			}
+			(*starts)[nbatches++] = i;
+			used = fixed;
+		}
+		used += arg_size(argv[i]);
+	}
+	(*starts)[nbatches] = argc;
+
+	return nbatches;
+}
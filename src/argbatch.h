@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ARGBATCH_H
+#define _ARGBATCH_H
+
+#include <stddef.h>
+
+/**
+ * Batching of command lines that exceed ARG_MAX.
+ *
+ * With MINISHELL_ARG_BATCH set to N > 0, an external command whose
+ * arguments and environment do not fit in sysconf(_SC_ARG_MAX) is run
+ * several times, each time with as many of the arguments as fit, like
+ * xargs does. Up to N batches run at the same time; the status is the
+ * largest one of the batches.
+ */
+
+/**
+ * Maximum number of batches running at the same time, 0 if batching is
+ * disabled.
+ */
+int argbatch_jobs(void);
+
+/**
+ * Split the arguments argv[1..argc - 1] in batches that fit along with
+ * argv[0] and the environment. Returns 0 if the whole command line fits,
+ * else the number of batches; batch i gets the arguments from
+ * (*starts)[i] to (*starts)[i + 1], excluded. The caller frees *starts.
+ */
+size_t argbatch_split(char **argv, int argc, int **starts);
+
+#endif /* _ARGBATCH_H */
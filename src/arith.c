@@ -0,0 +1,538 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "arith.h"
+#include "utils.h"
+
+/* Variables referring to each other are followed this deep. */
+#define ARITH_MAX_DEPTH		32
+/* Parentheses, prefix operators and assignments nest this deep, as in bash. */
+#define ARITH_MAX_NEST		1024
+
+struct arith {
+	const char *expr;
+	const char *p;
+	const char *error;
+	/* Inside the branch of && || ?: that is not taken. */
+	int noeval;
+	int depth;
+	int nest;
+};
+
+static int64_t comma(struct arith *a);
+static int64_t assign(struct arith *a);
+static int64_t unary(struct arith *a);
+
+/*
+ * The operations are done on unsigned values, so that overflows wrap
+ * around instead of being undefined.
+ */
+#define WRAP(x)		((uint64_t)(x))
+
+static void fail(struct arith *a, const char *error)
+{
+	if (a->error == NULL)
+		a->error = error;
+	/* Stop parsing, every operator lookup fails from now on. */
+	a->p = "";
+}
+
+static void skip_blanks(struct arith *a)
+{
+	while (isspace((unsigned char)*a->p))
+		a->p++;
+}
+
+static bool is_name_start(char c)
+{
+	return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_name_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/**
+ * Consume the operator `op` unless it is directly followed by one of the
+ * characters in `not_before`, which would make it a different operator.
+ */
+static bool match(struct arith *a, const char *op, const char *not_before)
+{
+	size_t len = strlen(op);
+
+	skip_blanks(a);
+	if (strncmp(a->p, op, len) != 0)
+		return false;
+	if (a->p[len] != '\0' && strchr(not_before, a->p[len]) != NULL)
+		return false;
+
+	a->p += len;
+	return true;
+}
+
+static void expect(struct arith *a, const char *op)
+{
+	if (!match(a, op, ""))
+		fail(a, *a->p == '\0' ? "unexpected end of expression" :
+					"syntax error");
+}
+
+static char *parse_name(struct arith *a)
+{
+	const char *start = a->p;
+	char *name;
+
+	while (is_name_char(*a->p))
+		a->p++;
+
+	name = strndup(start, a->p - start);
+	DIE(name == NULL, "strndup");
+
+	return name;
+}
+
+static int64_t parse_number(struct arith *a)
+{
+	uint64_t value = 0;
+	int base = 10, digit;
+
+	if (a->p[0] == '0' && (a->p[1] == 'x' || a->p[1] == 'X')) {
+		base = 16;
+		a->p += 2;
+		if (!isxdigit((unsigned char)*a->p)) {
+			fail(a, "invalid number");
+			return 0;
+		}
+	} else if (a->p[0] == '0') {
+		base = 8;
+	}
+
+	for (; isalnum((unsigned char)*a->p); a->p++) {
+		if (isdigit((unsigned char)*a->p))
+			digit = *a->p - '0';
+		else if (base == 16 && isxdigit((unsigned char)*a->p))
+			digit = tolower((unsigned char)*a->p) - 'a' + 10;
+		else
+			digit = base;
+
+		if (digit >= base) {
+			fail(a, "invalid number");
+			return 0;
+		}
+		value = value * base + digit;
+	}
+
+	return (int64_t)value;
+}
+
+static int64_t get_variable(struct arith *a, const char *name)
+{
+	const char *value = getenv(name);
+	struct arith sub = { 0 };
+	int64_t result;
+
+	if (value == NULL)
+		return 0;
+
+	if (a->depth >= ARITH_MAX_DEPTH) {
+		fail(a, "expression recursion level exceeded");
+		return 0;
+	}
+
+	sub.expr = value;
+	sub.p = value;
+	sub.noeval = a->noeval;
+	sub.depth = a->depth + 1;
+	sub.nest = a->nest;
+
+	skip_blanks(&sub);
+	if (*sub.p == '\0')
+		return 0;
+
+	result = comma(&sub);
+	skip_blanks(&sub);
+	if (sub.error == NULL && *sub.p != '\0')
+		fail(&sub, "syntax error");
+	if (sub.error != NULL)
+		fail(a, sub.error);
+
+	return result;
+}
+
+static void set_variable(struct arith *a, const char *name, int64_t value)
+{
+	char buf[ARITH_BUFSIZ];
+
+	if (a->noeval || a->error != NULL)
+		return;
+
+	snprintf(buf, sizeof(buf), "%" PRId64, value);
+	DIE(setenv(name, buf, 1) < 0, "setenv");
+}
+
+/**
+ * Apply a binary operator; `op` is the operator without a trailing =.
+ */
+static int64_t apply(struct arith *a, const char *op, int64_t x, int64_t y)
+{
+	switch (op[0]) {
+	case '*':
+		return WRAP(x) * WRAP(y);
+	case '/':
+	case '%':
+		if (a->noeval)
+			return 0;
+		if (y == 0) {
+			fail(a, "division by 0");
+			return 0;
+		}
+		/* INT64_MIN / -1 overflows. */
+		if (y == -1)
+			return op[0] == '/' ? (int64_t)-WRAP(x) : 0;
+		return op[0] == '/' ? x / y : x % y;
+	case '+':
+		return WRAP(x) + WRAP(y);
+	case '-':
+		return WRAP(x) - WRAP(y);
+	case '<':
+		return WRAP(x) << (y & 63);
+	case '>':
+		return x >> (y & 63);
+	case '&':
+		return x & y;
+	case '^':
+		return x ^ y;
+	case '|':
+		return x | y;
+	}
+
+	return y;
+}
+
+/**
+ * Parse a nested operand with `parse`, failing before the recursion
+ * could overflow the stack.
+ */
+static int64_t nested(struct arith *a, int64_t (*parse)(struct arith *a))
+{
+	int64_t value;
+
+	if (a->nest >= ARITH_MAX_NEST) {
+		fail(a, "expression recursion level exceeded");
+		return 0;
+	}
+
+	a->nest++;
+	value = parse(a);
+	a->nest--;
+
+	return value;
+}
+
+static int64_t primary(struct arith *a)
+{
+	int64_t value;
+	char *name;
+
+	skip_blanks(a);
+
+	if (match(a, "(", "")) {
+		value = nested(a, comma);
+		expect(a, ")");
+		return value;
+	}
+
+	if (isdigit((unsigned char)*a->p)) {
+		value = parse_number(a);
+		if (is_name_start(*a->p))
+			fail(a, "invalid number");
+		return value;
+	}
+
+	if (!is_name_start(*a->p)) {
+		fail(a, *a->p == '\0' ? "unexpected end of expression" :
+					"syntax error");
+		return 0;
+	}
+
+	name = parse_name(a);
+	value = get_variable(a, name);
+
+	/* Postfix increment and decrement. */
+	if (match(a, "++", ""))
+		set_variable(a, name, WRAP(value) + 1);
+	else if (match(a, "--", ""))
+		set_variable(a, name, WRAP(value) - 1);
+
+	free(name);
+	return value;
+}
+
+static int64_t unary(struct arith *a)
+{
+	const char *after;
+	int64_t value;
+	char *name;
+
+	skip_blanks(a);
+
+	/* Prefix increment and decrement apply to variables only. */
+	if (strncmp(a->p, "++", 2) == 0 || strncmp(a->p, "--", 2) == 0) {
+		for (after = a->p + 2; isspace((unsigned char)*after); after++)
+			;
+		if (is_name_start(*after)) {
+			bool increment = a->p[0] == '+';
+
+			a->p = after;
+			name = parse_name(a);
+			value = get_variable(a, name);
+			value = increment ? WRAP(value) + 1 : WRAP(value) - 1;
+			set_variable(a, name, value);
+			free(name);
+			return value;
+		}
+	}
+
+	if (match(a, "+", "="))
+		return nested(a, unary);
+	if (match(a, "-", "="))
+		return -WRAP(nested(a, unary));
+	if (match(a, "!", "="))
+		return !nested(a, unary);
+	if (match(a, "~", ""))
+		return ~nested(a, unary);
+
+	return primary(a);
+}
+
+static int64_t multiplicative(struct arith *a)
+{
+	int64_t value = unary(a);
+
+	for (;;) {
+		if (match(a, "*", "="))
+			value = apply(a, "*", value, unary(a));
+		else if (match(a, "/", "="))
+			value = apply(a, "/", value, unary(a));
+		else if (match(a, "%", "="))
+			value = apply(a, "%", value, unary(a));
+		else
+			return value;
+	}
+}
+
+static int64_t additive(struct arith *a)
+{
+	int64_t value = multiplicative(a);
+
+	for (;;) {
+		if (match(a, "+", "="))
+			value = apply(a, "+", value, multiplicative(a));
+		else if (match(a, "-", "="))
+			value = apply(a, "-", value, multiplicative(a));
+		else
+			return value;
+	}
+}
+
+static int64_t shift(struct arith *a)
+{
+	int64_t value = additive(a);
+
+	for (;;) {
+		if (match(a, "<<", "="))
+			value = apply(a, "<", value, additive(a));
+		else if (match(a, ">>", "="))
+			value = apply(a, ">", value, additive(a));
+		else
+			return value;
+	}
+}
+
+static int64_t relational(struct arith *a)
+{
+	int64_t value = shift(a);
+
+	for (;;) {
+		if (match(a, "<=", ""))
+			value = value <= shift(a);
+		else if (match(a, ">=", ""))
+			value = value >= shift(a);
+		else if (match(a, "<", "<="))
+			value = value < shift(a);
+		else if (match(a, ">", ">="))
+			value = value > shift(a);
+		else
+			return value;
+	}
+}
+
+static int64_t equality(struct arith *a)
+{
+	int64_t value = relational(a);
+
+	for (;;) {
+		if (match(a, "==", ""))
+			value = value == relational(a);
+		else if (match(a, "!=", ""))
+			value = value != relational(a);
+		else
+			return value;
+	}
+}
+
+static int64_t bitwise_and(struct arith *a)
+{
+	int64_t value = equality(a);
+
+	while (match(a, "&", "&="))
+		value &= equality(a);
+
+	return value;
+}
+
+static int64_t bitwise_xor(struct arith *a)
+{
+	int64_t value = bitwise_and(a);
+
+	while (match(a, "^", "="))
+		value ^= bitwise_and(a);
+
+	return value;
+}
+
+static int64_t bitwise_or(struct arith *a)
+{
+	int64_t value = bitwise_xor(a);
+
+	while (match(a, "|", "|="))
+		value |= bitwise_xor(a);
+
+	return value;
+}
+
+static int64_t logical_and(struct arith *a)
+{
+	int64_t value = bitwise_or(a);
+	bool skip;
+
+	while (match(a, "&&", "")) {
+		skip = !value;
+		a->noeval += skip;
+		value = bitwise_or(a) && value;
+		a->noeval -= skip;
+	}
+
+	return value;
+}
+
+static int64_t logical_or(struct arith *a)
+{
+	int64_t value = logical_and(a);
+	bool skip;
+
+	while (match(a, "||", "")) {
+		skip = value;
+		a->noeval += skip;
+		value = logical_and(a) || value;
+		a->noeval -= skip;
+	}
+
+	return value;
+}
+
+static int64_t conditional(struct arith *a)
+{
+	int64_t cond = logical_or(a), first, second;
+
+	if (!match(a, "?", ""))
+		return cond;
+
+	a->noeval += !cond;
+	first = nested(a, comma);
+	a->noeval -= !cond;
+
+	expect(a, ":");
+
+	a->noeval += !!cond;
+	second = nested(a, assign);
+	a->noeval -= !!cond;
+
+	return cond ? first : second;
+}
+
+static int64_t assign(struct arith *a)
+{
+	static const char * const ops[] = {
+		"=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=",
+		NULL
+	};
+	const char *start;
+	int64_t value;
+	char *name;
+	size_t i;
+
+	skip_blanks(a);
+	if (!is_name_start(*a->p))
+		return conditional(a);
+
+	start = a->p;
+	name = parse_name(a);
+
+	for (i = 0; ops[i] != NULL; i++)
+		if (match(a, ops[i], "="))
+			break;
+
+	if (ops[i] == NULL) {
+		/* Not an assignment, parse the name again as an operand. */
+		free(name);
+		a->p = start;
+		return conditional(a);
+	}
+
+	value = nested(a, assign);
+	if (i > 0)
+		value = apply(a, ops[i], get_variable(a, name), value);
+	set_variable(a, name, value);
+
+	free(name);
+	return value;
+}
+
+static int64_t comma(struct arith *a)
+{
+	int64_t value = assign(a);
+
+	while (match(a, ",", ""))
+		value = assign(a);
+
+	return value;
+}
+
+int arith_eval(const char *expr, int64_t *result)
+{
+	struct arith a = { 0 };
+
+	a.expr = expr;
+	a.p = expr;
+
+	skip_blanks(&a);
+	*result = *a.p == '\0' ? 0 : comma(&a);
+
+	skip_blanks(&a);
+	if (a.error == NULL && *a.p != '\0')
+		fail(&a, "syntax error");
+
+	if (a.error != NULL) {
+		fprintf(stderr, "arithmetic: %s: %s\n", expr, a.error);
+		return -1;
+	}
+
+	return 0;
+}
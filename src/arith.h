@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ARITH_H
+#define _ARITH_H
+
+#include <stdint.h>
+
+/**
+ * Arithmetic expansion $((...)), evaluated in the shell process.
+ *
+ * Expressions use 64-bit signed integers that wrap around on overflow
+ * and the C operators with their usual precedence: unary + - ! ~ and
+ * ++ --, binary * / % + - << >> < <= > >= == != & ^ | && ||, ?: and the
+ * assignments = *= /= %= += -= <<= >>= &= ^= |=, and the comma.
+ * Numbers are decimal, octal (leading 0) or hexadecimal (leading 0x).
+ *
+ * Variables are read from the environment, an unset or empty variable
+ * being 0; the value of a variable is itself evaluated as an expression.
+ * Assignments store the result back in the environment.
+ */
+
+/* Room for the decimal representation of any result. */
+#define ARITH_BUFSIZ		24
+
+/**
+ * Evaluate `expr` and store its value in `*result`. Returns 0 on success,
+ * -1 after reporting a syntax or division error on stderr.
+ */
+int arith_eval(const char *expr, int64_t *result);
+
+#endif /* _ARITH_H */
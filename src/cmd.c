@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,12 +14,78 @@
 
 #include "cmd.h"
 #include "utils.h"
+#include "parallel.h"
+#include "fdcache.h"
+#include "argbatch.h"
+#include "stats.h"
+#include "timeout.h"
+#include "fanout.h"
+#include "keeporder.h"
+#include "profile.h"
+#include "memo.h"
+#include "ring.h"
+#include "read.h"
+#include "affinity.h"
+#include "meter.h"
+
+/*
+ * Deadline of the external commands run by the timeout internal command,
+ * zero outside of it.
+ */
+static struct timespec time_limit;
+static struct timespec time_grace;
+
+/* Scheduling settings of the external commands run by sched. */
+static struct sched_settings job_sched = SCHED_SETTINGS_INIT;
+
+static bool has_time_limit(void)
+{
+	return time_limit.tv_sec != 0 || time_limit.tv_nsec != 0;
+}
+
+/**
+ * Tell if the shell reads an interactive terminal it has the control of.
+ */
+static bool owns_terminal(void)
+{
+	return isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+}
+
+/**
+ * Make `pgrp` the foreground group of the terminal. The caller may be in
+ * the background already, where tcsetpgrp() would stop it.
+ */
+static void give_terminal(pid_t pgrp)
+{
+	sigset_t set, old;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &set, &old);
+	tcsetpgrp(STDIN_FILENO, pgrp);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+static int run_simple(simple_command_t *s, int level, command_t *father);
+static int run_external(simple_command_t *s, char **argv, int argc);
+
+static void free_argv(char **argv, int argc)
+{
+	int i;
+
+	for (i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+}
 
 /**
  * Internal change-directory command.
  */
 static bool shell_cd(word_t *dir)
 {
+	/* Relative redirection targets now name other files. */
+	fdcache_flush();
+
 	/* Execute cd. */
 	if (chdir(dir->string) == -1)
 		return false;
@@ -34,11 +101,444 @@ static int shell_exit(void)
 	exit(0);
 }
 
+/**
+ * Open a redirection target in the child, reusing the descriptor from the
+ * append cache if there is one.
+ */
+static int open_redirect(const char *path, int flags, int cached)
+{
+	int fd = cached >= 0 ? dup(cached) : open(path, flags, 0644);
+
+	DIE(fd == -1, "open");
+	return fd;
+}
+
+/* Redirection targets of an external command and how to open them. */
+struct redirects {
+	char *out;
+	char *err;
+	int out_flags;
+	int err_flags;
+	int out_cached;
+	int err_cached;
+	bool shared;	/* stdout and stderr go to the same target */
+};
+
+/**
+ * Fork a child that performs the redirections and loads the executable.
+ */
+static pid_t spawn_simple(simple_command_t *s, const char *command, char **argv,
+			  struct redirects *r)
+{
+	/*
+	 * The group of a timed command must stay in the foreground of an
+	 * interactive terminal, for it to read it and get Ctrl-C.
+	 */
+	bool foreground = has_time_limit() && owns_terminal();
+	int fd;
+	pid_t pid = stats_fork();
+
+	switch (pid) {
+	case -1:
+		/* Error */
+		DIE(1, "fork");
+		break;
+	case 0:
+		/* Child process */
+		/* The whole group is signaled when the deadline expires. */
+		if (has_time_limit())
+			setpgid(0, 0);
+		if (foreground)
+			give_terminal(getpid());
+
+		if (s->in != NULL) {
+			fd = open(s->in->string, O_RDONLY);
+			DIE(fd == -1, "open");
+			dup2(fd, STDIN_FILENO);
+			close(fd);
+		}
+
+		/* If `s->out` and `s->err` are the same: "command &> file" */
+		if (r->shared) {
+			fd = open_redirect(r->out, r->out_flags, r->out_cached);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		} else { /* Different redirections for `stdout` and `stderr` */
+			/* Set `stdout` */
+			if (s->out != NULL) {
+				fd = open_redirect(r->out, r->out_flags, r->out_cached);
+				dup2(fd, STDOUT_FILENO);
+				close(fd);
+			}
+
+			/* Set `stderr` */
+			if (s->err != NULL) {
+				fd = open_redirect(r->err, r->err_flags, r->err_cached);
+				dup2(fd, STDERR_FILENO);
+				close(fd);
+			}
+		}
+
+		sched_apply(&job_sched);
+
+		/* Execute the `command` with `argv` */
+		stats_exec();
+		execvp(command, argv);
+		stats_add(STATS_EXEC_FAILURES, 1);
+		fprintf(stderr, "Execution failed for '%s'\n", command);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Either one may run first; the group must exist before a kill. */
+	if (has_time_limit())
+		setpgid(pid, 0);
+	if (foreground)
+		give_terminal(pid);
+
+	return pid;
+}
+
+/**
+ * Wait for a child and return its exit status.
+ */
+static int wait_simple(pid_t pid)
+{
+	bool expired;
+	int status;
+
+	if (has_time_limit()) {
+		expired = timeout_wait(pid, &time_limit, &time_grace, &status);
+
+		/* Take the terminal back from the group of the command. */
+		if (isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == pid)
+			give_terminal(getpgrp());
+		if (expired)
+			return TIMEOUT_EXPIRED;
+	} else {
+		stats_waitpid(pid, &status, 0);
+	}
+
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	return 1;
+}
+
+/**
+ * Run an external command once per batch of arguments, with up to
+ * argbatch_jobs() batches at a time. Returns the largest status.
+ */
+static int run_batches(simple_command_t *s, const char *command, char **argv,
+		       int *starts, size_t nbatches, struct redirects *r)
+{
+	size_t jobs = argbatch_jobs(), first = 0, i;
+	int status, ret = 0, fd;
+	char **batch_argv;
+	pid_t *pids;
+
+	/* Truncate once; the batches add to the output of the previous ones. */
+	if (s->out != NULL && (r->out_flags & O_TRUNC)) {
+		fd = open(r->out, r->out_flags, 0644);
+		if (fd >= 0)
+			close(fd);
+		r->out_flags = (r->out_flags & ~O_TRUNC) | O_APPEND;
+	}
+	if (s->err != NULL && (r->err_flags & O_TRUNC)) {
+		fd = open(r->err, r->err_flags, 0644);
+		if (fd >= 0)
+			close(fd);
+		r->err_flags = (r->err_flags & ~O_TRUNC) | O_APPEND;
+	}
+
+	pids = malloc(nbatches * sizeof(*pids));
+	DIE(pids == NULL, "malloc");
+	batch_argv = malloc((starts[nbatches] - starts[0] + 2) * sizeof(*batch_argv));
+	DIE(batch_argv == NULL, "malloc");
+	batch_argv[0] = argv[0];
+
+	for (i = 0; i < nbatches; i++) {
+		if (i - first == jobs) {
+			status = wait_simple(pids[first++]);
+			ret = status > ret ? status : ret;
+		}
+
+		/* The child gets its own copy of batch_argv. */
+		memcpy(batch_argv + 1, argv + starts[i],
+		       (starts[i + 1] - starts[i]) * sizeof(*batch_argv));
+		batch_argv[starts[i + 1] - starts[i] + 1] = NULL;
+		pids[i] = spawn_simple(s, command, batch_argv, r);
+	}
+
+	while (first < nbatches) {
+		status = wait_simple(pids[first++]);
+		ret = status > ret ? status : ret;
+	}
+
+	free(batch_argv);
+	free(pids);
+
+	return ret;
+}
+
+/**
+ * Open the output redirection of an internal command printing a report,
+ * stdout or the ring of the next pipeline stage if there is none. Returns
+ * NULL if it cannot be opened.
+ */
+static FILE *open_report(simple_command_t *s)
+{
+	FILE *file = ring_stdout() != NULL ? ring_stdout() : stdout;
+	char *path;
+
+	if (s->out != NULL) {
+		path = get_word(s->out);
+		file = fopen(path, s->io_flags & IO_OUT_APPEND ? "a" : "w");
+		if (file == NULL)
+			perror(path);
+		free(path);
+	}
+
+	return file;
+}
+
+static void close_report(FILE *file)
+{
+	if (file == stdout || file == ring_stdout())
+		fflush(file);
+	else
+		fclose(file);
+}
+
+/**
+ * Internal stats command, printing the runtime counters to stdout or to
+ * the output redirection.
+ */
+static int shell_stats(simple_command_t *s)
+{
+	FILE *file = open_report(s);
+
+	if (file == NULL)
+		return 1;
+
+	stats_print(file);
+	close_report(file);
+
+	return 0;
+}
+
+/**
+ * Parse the duration in `word` into `duration`, reporting it if invalid.
+ */
+static bool parse_duration(word_t *word, struct timespec *duration)
+{
+	char *arg = get_word(word);
+	bool ok = timeout_parse(arg, duration);
+
+	if (!ok)
+		fprintf(stderr, "timeout: invalid duration '%s'\n", arg);
+	free(arg);
+
+	return ok;
+}
+
+/**
+ * Internal timeout command, running the rest of the command line with a
+ * deadline.
+ */
+static int shell_timeout(simple_command_t *s, int level, command_t *father)
+{
+	struct timespec saved_limit = time_limit, saved_grace = time_grace;
+	struct timespec limit, grace;
+	word_t *word = s->params;
+	simple_command_t inner;
+	char *arg;
+	int ret;
+
+	timeout_parse(TIMEOUT_GRACE, &grace);
+
+	if (word != NULL) {
+		arg = get_word(word);
+		if (strcmp(arg, "-k") == 0 && word->next_word != NULL) {
+			word = word->next_word;
+			if (!parse_duration(word, &grace)) {
+				free(arg);
+				return TIMEOUT_USAGE;
+			}
+			word = word->next_word;
+		}
+		free(arg);
+	}
+
+	if (word == NULL || word->next_word == NULL) {
+		fprintf(stderr, "Usage: timeout [-k GRACE] DURATION COMMAND [ARG]...\n");
+		return TIMEOUT_USAGE;
+	}
+	if (!parse_duration(word, &limit))
+		return TIMEOUT_USAGE;
+
+	/* The command is the rest of the words, with the same redirections. */
+	inner = *s;
+	inner.verb = word->next_word;
+	inner.params = inner.verb->next_word;
+
+	time_limit = limit;
+	time_grace = grace;
+	ret = run_simple(&inner, level, father);
+	time_limit = saved_limit;
+	time_grace = saved_grace;
+
+	return ret;
+}
+
+const char * const builtin_names[] = {
+	"cd", "exit", "fdcache", "memo", "parallel", "quit", "read", "sched",
+	"stats", "timeout", NULL
+};
+
+bool is_builtin(word_t *verb)
+{
+	size_t i;
+
+	for (i = 0; builtin_names[i] != NULL; i++)
+		if (strcmp(verb->string, builtin_names[i]) == 0)
+			return true;
+
+	return false;
+}
+
+/**
+ * Internal memo command, replaying the output of the rest of the command
+ * line from the cache or running it and storing its output.
+ */
+static int shell_memo(simple_command_t *s)
+{
+	struct memo_capture capture;
+	simple_command_t inner;
+	struct memo_key key;
+	int status, argc;
+	char **argv;
+	FILE *file;
+	word_t *word;
+
+	if (s->params != NULL && strcmp(s->params->string, "--stats") == 0) {
+		file = open_report(s);
+		if (file == NULL)
+			return 1;
+		memo_print_stats(file);
+		close_report(file);
+		return 0;
+	}
+
+	word = memo_command(s->params);
+	if (word == NULL) {
+		fprintf(stderr, "Usage: memo [-i PATH]... [-e NAME]... COMMAND [ARG]...\n"
+				"       memo --stats\n");
+		return MEMO_USAGE;
+	}
+	if (is_builtin(word) || is_assignment(word)) {
+		fprintf(stderr, "memo: only external commands can be cached\n");
+		return MEMO_USAGE;
+	}
+
+	/* The command writes to the capture, the output is copied out. */
+	inner = *s;
+	inner.verb = word;
+	inner.params = word->next_word;
+	inner.out = NULL;
+	inner.err = NULL;
+	inner.io_flags = IO_REGULAR;
+
+	/* Expanded once: $((...)) must not differ between key and run. */
+	argv = get_argv(&inner, &argc);
+	if (!memo_key(s->params, &inner, argv, argc, &key)) {
+		/* Its input is not known in advance: run, with the redirections. */
+		status = run_external(s, argv, argc);
+	} else {
+		status = memo_replay(&key, s);
+		if (status < 0) {
+			memo_capture_start(&capture);
+			status = run_external(&inner, argv, argc);
+			status = memo_capture_finish(&capture, &key, status, s);
+		}
+	}
+	memo_key_release(&key);
+
+	free_argv(argv, argc);
+	return status;
+}
+
+/**
+ * Internal sched command, running the rest of the command line with
+ * scheduling settings.
+ */
+static int shell_sched(simple_command_t *s, int level, command_t *father)
+{
+	struct sched_settings saved = job_sched;
+	simple_command_t inner;
+	word_t *word;
+	int ret;
+
+	word = sched_parse(s->params, &job_sched);
+	if (word == NULL) {
+		fprintf(stderr, "Usage: sched [-c CPUS] [-m NODE] [-n NICE] [-i CLASS[:LEVEL]] [-p batch|idle]\n"
+				"             COMMAND [ARG]...\n");
+		job_sched = saved;
+		return SCHED_USAGE;
+	}
+
+	/* The command is the rest of the words, with the same redirections. */
+	inner = *s;
+	inner.verb = word;
+	inner.params = word->next_word;
+
+	ret = run_simple(&inner, level, father);
+	job_sched = saved;
+
+	return ret;
+}
+
+/**
+ * Internal read command, setting variables from a line of stdin, of the
+ * input redirection or of the previous stage of an in-process pipeline.
+ */
+static int shell_read(simple_command_t *s)
+{
+	word_t *names = s->params;
+	FILE *stream = ring_stdin();
+	int fd = STDIN_FILENO, ret;
+	bool raw = false;
+	char *line;
+
+	if (names != NULL && strcmp(names->string, "-r") == 0) {
+		raw = true;
+		names = names->next_word;
+	}
+
+	if (s->in != NULL) {
+		stream = NULL;
+		fd = open(s->in->string, O_RDONLY);
+		if (fd < 0) {
+			perror(s->in->string);
+			return 1;
+		}
+	}
+
+	ret = read_input(stream, fd, raw, &line);
+	if (!read_assign(names, line, raw))
+		ret = 2;
+	free(line);
+
+	if (s->in != NULL)
+		close(fd);
+
+	return ret;
+}
+
 /**
  * Parse a simple command (internal, environment variable assignment,
  * external command).
  */
-static int parse_simple(simple_command_t *s, int level, command_t *father)
+static int run_simple(simple_command_t *s, int level, command_t *father)
 {
 	/* Sanity checks. */
 	if (s->verb == NULL)
@@ -46,11 +546,13 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 
 	/* If builtin command, execute the command. */
 	if (strcmp(s->verb->string, "exit") == 0 || strcmp(s->verb->string, "quit") == 0) {
+		stats_add(STATS_BUILTINS, 1);
 		DIE(s->params, "exit: Too many arguments\n");
 		return shell_exit();
 	}
 
 	if (strcmp(s->verb->string, "cd") == 0) {
+		stats_add(STATS_BUILTINS, 1);
 		if (!s->params)
 			return 0;
 
@@ -74,10 +576,46 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 		return 1;
 	}
 
+	if (strcmp(s->verb->string, "parallel") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		return shell_parallel(s, level);
+	}
+
+	if (strcmp(s->verb->string, "fdcache") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		fdcache_flush();
+		return 0;
+	}
+
+	if (strcmp(s->verb->string, "stats") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		return shell_stats(s);
+	}
+
+	if (strcmp(s->verb->string, "timeout") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		return shell_timeout(s, level, father);
+	}
+
+	if (strcmp(s->verb->string, "memo") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		return shell_memo(s);
+	}
+
+	if (strcmp(s->verb->string, "read") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		return shell_read(s);
+	}
+
+	if (strcmp(s->verb->string, "sched") == 0) {
+		stats_add(STATS_BUILTINS, 1);
+		return shell_sched(s, level, father);
+	}
+
 	/* If variable assignment, execute the assignment and return
 	 * the exit status.
 	 */
-	if (s->verb != NULL && s->params == NULL && strchr(get_word(s->verb), '=') != NULL) {
+	if (s->verb != NULL && s->params == NULL && is_assignment(s->verb)) {
 		/* Get the variable name and value */
 		const char *var_name = s->verb->string;
 		char *var_value = NULL;
@@ -101,90 +639,108 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 	 */
 	/* Extract command and arguments */
 	int argc;
-	char *command = get_word(s->verb);
 	char **argv = get_argv(s, &argc);
+	int status = run_external(s, argv, argc);
+
+	free_argv(argv, argc);
+	return status;
+}
+
+/**
+ * Run an external command with its arguments already expanded, so that
+ * the expansions happen once.
+ */
+static int run_external(simple_command_t *s, char **argv, int argc)
+{
+	char *command = argv[0];
 
 	/* Extract redirections */
-	char *out_redir = NULL, *err_redir = NULL;
+	struct redirects r = { NULL, NULL, 0, 0, -1, -1, false };
 
 	if (s->out != NULL)
-		out_redir = get_word(s->out);
+		r.out = get_word(s->out);
 	if (s->err != NULL)
-		err_redir = get_word(s->err);
+		r.err = get_word(s->err);
 
-	int fd, status;
-	int out_flags = 0, err_flags = 0;
+	r.out_flags = O_WRONLY | O_CREAT;
+	if (s->io_flags & IO_OUT_APPEND)
+		r.out_flags |= O_APPEND;
+	else
+		r.out_flags |= O_TRUNC;
 
-	pid_t pid = fork();
+	r.err_flags = O_WRONLY | O_CREAT;
+	if (s->io_flags & IO_ERR_APPEND)
+		r.err_flags |= O_APPEND;
+	else
+		r.err_flags |= O_TRUNC;
 
-	switch (pid) {
-	case -1:
-		/* Error */
-		DIE(1, "fork");
-		break;
-	case 0:
-		/* Child process */
-		if (s->in != NULL) {
-			fd = open(s->in->string, O_RDONLY);
-			DIE(fd == -1, "open");
-			dup2(fd, STDIN_FILENO);
-			close(fd);
-		}
+	/* Truncating a cached target would leave its descriptor stale. */
+	if ((s->out != NULL && !(s->io_flags & IO_OUT_APPEND)) ||
+	    (s->err != NULL && !(s->io_flags & IO_ERR_APPEND))) {
+		fdcache_flush();
+	} else {
+		if (s->out != NULL)
+			r.out_cached = fdcache_open(r.out);
+		if (s->err != NULL)
+			r.err_cached = fdcache_open(r.err);
+	}
 
-		/* If `s->out` and `s->err` are the same: "command &> file" */
-		if (s->out != NULL && s->err != NULL && strcmp(out_redir, err_redir) == 0) {
-			out_flags = O_WRONLY | O_CREAT;
-			if (s->io_flags & IO_OUT_APPEND)
-				out_flags |= O_APPEND;
-			else
-				out_flags |= O_TRUNC;
-			fd = open(out_redir, out_flags, 0644);
-			DIE(fd == -1, "open");
-			dup2(fd, STDOUT_FILENO);
-			dup2(fd, STDERR_FILENO);
-			close(fd);
-		} else { /* Different redirections for `stdout` and `stderr` */
-			/* Set `stdout` */
-			out_flags = O_WRONLY | O_CREAT;
-			if (s->io_flags & IO_OUT_APPEND)
-				out_flags |= O_APPEND;
-			else
-				out_flags |= O_TRUNC;
-			if (s->out != NULL) {
-				fd = open(out_redir, out_flags, 0644);
-				DIE(fd == -1, "open");
-				dup2(fd, STDOUT_FILENO);
-				close(fd);
-			}
+	/* Every target of a stream redirected several times gets a copy. */
+	struct fanout out_fanout = { -1, -1 }, err_fanout = { -1, -1 };
 
-			/* Set `stderr` */
-			err_flags = O_WRONLY | O_CREAT;
-			if (s->io_flags & IO_ERR_APPEND)
-				err_flags |= O_APPEND;
-			else
-				err_flags |= O_TRUNC;
-			if (s->err != NULL) {
-				fd = open(err_redir, err_flags, 0644);
-				DIE(fd == -1, "open");
-				dup2(fd, STDERR_FILENO);
-				close(fd);
-			}
+	if (fanout_needed(s->out)) {
+		if (!fanout_start(s->out, s->io_flags & IO_OUT_APPEND, &out_fanout))
+			return 1;
+		r.out_cached = out_fanout.fd;
+	}
+	if (fanout_needed(s->err) && s->err != s->out) {
+		if (!fanout_start(s->err, s->io_flags & IO_ERR_APPEND, &err_fanout)) {
+			fanout_finish(&out_fanout);
+			return 1;
 		}
+		r.err_cached = err_fanout.fd;
+	}
 
-		/* Execute the `command` with `argv` */
-		execvp(command, argv);
-		fprintf(stderr, "Execution failed for '%s'\n", command);
-		exit(EXIT_FAILURE);
-		break;
-	default:
-		/* Parent process */
-		waitpid(pid, &status, 0);
-		if (WIFEXITED(status))
-			return WEXITSTATUS(status);
-		return 1;
+	if (s->out != NULL && s->err != NULL)
+		r.shared = out_fanout.pid >= 0 || err_fanout.pid >= 0 ?
+			   s->out == s->err : strcmp(r.out, r.err) == 0;
+
+	/* Split the arguments if they do not fit in ARG_MAX. */
+	int *starts, status;
+	size_t nbatches = 0;
+
+	if (argbatch_jobs() > 0)
+		nbatches = argbatch_split(argv, argc, &starts);
+	if (nbatches > 0) {
+		status = run_batches(s, command, argv, starts, nbatches, &r);
+		free(starts);
+	} else {
+		status = wait_simple(spawn_simple(s, command, argv, &r));
 	}
 
-	return 0;
+	/* The stderr copier holds the stdout pipe, it must end first. */
+	fanout_finish(&err_fanout);
+	fanout_finish(&out_fanout);
+
+	return status;
+}
+
+/**
+ * Run a simple command, recording its wall time.
+ */
+static int parse_simple(simple_command_t *s, int level, command_t *father)
+{
+	uint64_t start = stats_now(), wall;
+	int ret;
+
+	profile_begin();
+	ret = run_simple(s, level, father);
+	wall = stats_now() - start;
+
+	stats_record(STATS_COMMAND_NS, wall);
+	profile_end(s, wall);
+
+	return ret;
 }
 
 /**
@@ -193,10 +749,18 @@ static int parse_simple(simple_command_t *s, int level, command_t *father)
 static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level, command_t *father)
 {
 	/* Execute cmd1 and cmd2 simultaneously. */
+	bool keep_order = keep_order_enabled();
+	struct job_output out1, out2;
 	pid_t pid1, pid2;
-	int status1, status2;
+	int status1, status2, slot;
+
+	if (keep_order) {
+		job_output_open(&out1);
+		job_output_open(&out2);
+	}
 
-	pid1 = fork();
+	slot = sched_spread_slot();
+	pid1 = stats_fork();
 	switch (pid1) {
 	case -1:
 		/* Error */
@@ -204,11 +768,15 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level, command
 		break;
 	case 0:
 		/* Child process 1 */
+		sched_spread_pin(slot);
+		if (keep_order)
+			job_output_redirect(&out1);
 		exit(parse_command(cmd1, level + 1, father));
 		break;
 	default:
 		/* Parent process */
-		pid2 = fork();
+		slot = sched_spread_slot();
+		pid2 = stats_fork();
 		switch (pid2) {
 		case -1:
 			/* Error */
@@ -216,12 +784,20 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level, command
 			break;
 		case 0:
 			/* Child process 2 */
+			sched_spread_pin(slot);
+			if (keep_order)
+				job_output_redirect(&out2);
 			exit(parse_command(cmd2, level + 1, father));
 			break;
 		default:
 			/* Parent process */
-			waitpid(pid1, &status1, 0);
-			waitpid(pid2, &status2, 0);
+			/* The output of cmd1 goes out while cmd2 may still run. */
+			stats_waitpid(pid1, &status1, 0);
+			if (keep_order)
+				job_output_flush(&out1);
+			stats_waitpid(pid2, &status2, 0);
+			if (keep_order)
+				job_output_flush(&out2);
 			if (WIFEXITED(status1) && WIFEXITED(status2))
 				return WEXITSTATUS(status1) && WEXITSTATUS(status2);
 			return true;
@@ -234,39 +810,74 @@ static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level, command
 
 
 /**
- * Run commands by creating an anonymous pipe (cmd1 | cmd2).
+ * Name of the first or last stage of a pipeline, for the pipe meter.
+ */
+static const char *stage_name(command_t *c, bool last)
+{
+	while (c->op == OP_PIPE)
+		c = last ? c->cmd2 : c->cmd1;
+
+	switch (c->op) {
+	case OP_NONE:
+		return c->scmd->verb->string;
+	case OP_FOR:
+		return "for";
+	case OP_WHILE:
+		return "while";
+	default:
+		return "list";
+	}
+}
+
+/**
+ * Make the pipe from `writer` to `reader`, metered if enabled.
+ */
+static void open_pipe(int fds[2], command_t *writer, command_t *reader,
+		      struct meter *m)
+{
+	m->pid = -1;
+	if (meter_enabled())
+		meter_start(fds, stage_name(writer, true), stage_name(reader, false), m);
+	else
+		DIE(pipe(fds) < 0, "pipe");
+}
+
+/**
+ * Run commands by creating an anonymous pipe (cmd1 | cmd2). Returns the
+ * status of cmd2.
  */
-static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level, command_t *father)
+static int run_on_pipe(command_t *cmd1, command_t *cmd2, int level, command_t *father)
 {
 	/* Redirect the output of cmd1 to the input of cmd2. */
 	int pipefd[2];
 	pid_t pid1, pid2;
-	int status1, status2;
-	bool success = false;
+	int status1, status2, slot;
+	struct meter meter;
 
-	if (pipe(pipefd) == -1)
-		DIE(1, "pipe");
+	open_pipe(pipefd, cmd1, cmd2, &meter);
 
-	pid1 = fork();
+	slot = sched_spread_slot();
+	pid1 = stats_fork();
 
 	switch (pid1) {
 	case -1:
 		/* Error */
 		DIE(1, "fork");
 		break;
-	
+
 	case 0:
 		/* Child process 1 */
+		sched_spread_pin(slot);
 		close(pipefd[PIPE_READ]);
 		dup2(pipefd[PIPE_WRITE], STDOUT_FILENO);
 		close(pipefd[PIPE_WRITE]);
-		success = parse_command(cmd1, level + 1, father);
-		exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+		exit(parse_command(cmd1, level + 1, father));
 		break;
 
 	default:
 		/* Parent process */
-		pid2 = fork();
+		slot = sched_spread_slot();
+		pid2 = stats_fork();
 		switch (pid2) {
 		case -1:
 			/* Error */
@@ -275,32 +886,275 @@ static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level, command_t *
 
 		case 0:
 			/* Child process 2 */
+			sched_spread_pin(slot);
 			close(pipefd[PIPE_WRITE]);
 			dup2(pipefd[PIPE_READ], STDIN_FILENO);
 			close(pipefd[PIPE_READ]);
-			success = parse_command(cmd2, level + 1, father);
-			exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+			exit(parse_command(cmd2, level + 1, father));
 			break;
 
 		default:
 			/* Parent process */
 			close(pipefd[PIPE_READ]);
 			close(pipefd[PIPE_WRITE]);
-			
-			waitpid(pid1, &status1, 0);
-			if (!WIFEXITED(status1) || !WEXITSTATUS(status1))
-				success = false;
 
-			waitpid(pid2, &status2, 0);
-			if (!WIFEXITED(status2) || !WEXITSTATUS(status2))
-				success = false;
+			stats_waitpid(pid1, &status1, 0);
+			stats_waitpid(pid2, &status2, 0);
+			meter_finish(&meter);
 
-			return success;
+			/* Like the other shells, the last command decides. */
+			if (WIFEXITED(status2))
+				return WEXITSTATUS(status2);
+			return 1;
 		}
 		break;
 	}
 
-	return success;
+	return 1;
+}
+
+bool is_ring_builtin(simple_command_t *s)
+{
+	if (strcmp(s->verb->string, "stats") == 0 ||
+	    strcmp(s->verb->string, "read") == 0)
+		return true;
+
+	return strcmp(s->verb->string, "memo") == 0 && s->params != NULL &&
+	       strcmp(s->params->string, "--stats") == 0;
+}
+
+size_t pipeline_stages(command_t *c, command_t **stages, size_t n)
+{
+	if (c->op != OP_PIPE) {
+		if (stages != NULL)
+			stages[n] = c;
+		return n + 1;
+	}
+
+	n = pipeline_stages(c->cmd1, stages, n);
+	return pipeline_stages(c->cmd2, stages, n);
+}
+
+static bool in_ring(command_t *c)
+{
+	return c->op == OP_NONE && is_ring_builtin(c->scmd);
+}
+
+struct pipe_stage {
+	command_t *cmd;
+	int level;
+	command_t *father;
+};
+
+static int run_pipe_stage(void *arg)
+{
+	struct pipe_stage *p = arg;
+
+	return parse_command(p->cmd, p->level, p->father);
+}
+
+/**
+ * Run internal commands of a pipeline in this process, connected by ring
+ * buffers.
+ */
+static int run_in_ring(command_t **cmds, size_t n, int level, command_t *father)
+{
+	struct ring_stage *stages = calloc(n, sizeof(*stages));
+	struct pipe_stage *args = calloc(n, sizeof(*args));
+	size_t i;
+	int ret;
+
+	DIE(stages == NULL || args == NULL, "calloc");
+
+	for (i = 0; i < n; i++) {
+		args[i].cmd = cmds[i];
+		args[i].level = level + 1;
+		args[i].father = father;
+		stages[i].run = run_pipe_stage;
+		stages[i].arg = &args[i];
+	}
+	ret = ring_run(stages, n);
+
+	free(stages);
+	free(args);
+
+	return ret;
+}
+
+/**
+ * Run a pipeline with adjacent internal commands. Each run of them gets
+ * a single process, or none if there are only internal commands; kernel
+ * pipes are only used next to the other commands.
+ */
+static int run_segments(command_t **cmds, size_t n, int level,
+			command_t *father)
+{
+	pid_t *pids = calloc(n, sizeof(*pids));
+	struct meter *meters = calloc(n, sizeof(*meters));
+	size_t i, end, nsegments = 0;
+	int fds[2], in = -1, status = 0, slot;
+
+	DIE(pids == NULL || meters == NULL, "calloc");
+
+	for (i = 0; i < n; i = end) {
+		end = i + 1;
+		while (in_ring(cmds[i]) && end < n && in_ring(cmds[end]))
+			end++;
+
+		if (end < n)
+			open_pipe(fds, cmds[end - 1], cmds[end], &meters[nsegments]);
+
+		slot = sched_spread_slot();
+		pids[nsegments] = stats_fork();
+		DIE(pids[nsegments] < 0, "fork");
+		if (pids[nsegments] == 0) {
+			sched_spread_pin(slot);
+			if (in >= 0) {
+				dup2(in, STDIN_FILENO);
+				close(in);
+			}
+			if (end < n) {
+				dup2(fds[PIPE_WRITE], STDOUT_FILENO);
+				close(fds[PIPE_READ]);
+				close(fds[PIPE_WRITE]);
+			}
+			if (end - i > 1)
+				exit(run_in_ring(cmds + i, end - i, level, father));
+			exit(parse_command(cmds[i], level + 1, father));
+		}
+		nsegments++;
+
+		if (in >= 0)
+			close(in);
+		if (end < n) {
+			close(fds[PIPE_WRITE]);
+			in = fds[PIPE_READ];
+		}
+	}
+
+	for (i = 0; i < nsegments; i++)
+		stats_waitpid(pids[i], &status, 0);
+	for (i = 0; i + 1 < nsegments; i++)
+		meter_finish(&meters[i]);
+	free(meters);
+	free(pids);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/**
+ * Run a pipeline, with the internal commands that are next to each other
+ * in one process (see ring.h).
+ */
+static int run_pipeline(command_t *c, int level, command_t *father)
+{
+	size_t n = pipeline_stages(c, NULL, 0), i;
+	command_t **cmds = malloc(n * sizeof(*cmds));
+	bool all = true, adjacent = false;
+	int ret;
+
+	DIE(cmds == NULL, "malloc");
+	pipeline_stages(c, cmds, 0);
+
+	for (i = 0; i < n; i++) {
+		all = all && in_ring(cmds[i]);
+		adjacent = adjacent || (i > 0 && in_ring(cmds[i - 1]) && in_ring(cmds[i]));
+	}
+
+	if (all)
+		ret = run_in_ring(cmds, n, level, father);
+	else if (adjacent)
+		ret = run_segments(cmds, n, level, father);
+	else
+		ret = run_on_pipe(c->cmd1, c->cmd2, level, father);
+
+	free(cmds);
+
+	return ret;
+}
+
+/**
+ * Run the body of a for loop once per word, with the variable set to it.
+ * The body was parsed once; only its variable parts see the new value.
+ */
+static int run_for(command_t *c, int level)
+{
+	int argc, i, ret = 0;
+	char **argv = get_argv(c->scmd, &argc);
+
+	for (i = 1; i < argc && ret != SHELL_EXIT; i++) {
+		setenv(argv[0], argv[i], 1);
+		ret = parse_command(c->cmd1, level + 1, c);
+	}
+
+	for (i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+
+	return ret;
+}
+
+/**
+ * Run the body of a while loop as long as the condition succeeds.
+ */
+static int run_while(command_t *c, int level)
+{
+	int ret = 0;
+
+	while (ret != SHELL_EXIT && parse_command(c->cmd1, level + 1, c) == 0)
+		ret = parse_command(c->cmd2, level + 1, c);
+
+	return ret;
+}
+
+bool is_list(command_t *c)
+{
+	return c->op == OP_SEQUENTIAL || c->op == OP_CONDITIONAL_ZERO ||
+	       c->op == OP_CONDITIONAL_NZERO;
+}
+
+/**
+ * Run a list of commands joined by `;`, `&&` and `||`. The parser nests
+ * these operators to the left, so a list of N commands is a chain of N - 1
+ * nodes down the left side of the tree: it is walked down to the first
+ * command and back up through the parents instead of recursing, each node
+ * running its right side or not depending on the status so far.
+ */
+static int run_list(command_t *c, int level)
+{
+	command_t *node = c;
+	bool run = true;
+	int ret;
+
+	while (is_list(node->cmd1))
+		node = node->cmd1;
+
+	ret = parse_command(node->cmd1, level + 1, node);
+
+	for (;;) {
+		switch (node->op) {
+		case OP_SEQUENTIAL:
+			run = true;
+			break;
+		case OP_CONDITIONAL_ZERO:
+			/* && */
+			run = ret == 0;
+			break;
+		case OP_CONDITIONAL_NZERO:
+			/* || */
+			run = ret != 0;
+			break;
+		default:
+			break;
+		}
+
+		if (run)
+			ret = parse_command(node->cmd2, level + 1, node);
+
+		if (node == c)
+			return ret;
+		node = node->up;
+	}
 }
 
 /**
@@ -319,29 +1173,24 @@ int parse_command(command_t *c, int level, command_t *father)
 
 	switch (c->op) {
 	case OP_SEQUENTIAL:
-		/* Execute the commands one after the other. */
-		parse_command(c->cmd1, level + 1, c);
-		return parse_command(c->cmd2, level + 1, c);
+	case OP_CONDITIONAL_NZERO:
+	case OP_CONDITIONAL_ZERO:
+		/* Execute the commands one after the other, || and && by status. */
+		return run_list(c, level);
 
 	case OP_PARALLEL:
 		/* Execute the commands simultaneously. */
 		return run_in_parallel(c->cmd1, c->cmd2, level, c);
 
-	case OP_CONDITIONAL_NZERO:
-		/* Execute the second command only if the first one returns non zero. (||) */
-		if (parse_command(c->cmd1, level + 1, c) != 0)
-			return parse_command(c->cmd2, level + 1, c);
-		return 0;
-
-	case OP_CONDITIONAL_ZERO:
-		/* Execute the second command only if the first one returns zero. (&&) */
-		if (parse_command(c->cmd1, level + 1, c) == 0)
-			return parse_command(c->cmd2, level + 1, c);
-		return 0;
-
 	case OP_PIPE:
 		/* Redirect the output of the first command to the input of the second. */
-		return run_on_pipe(c->cmd1, c->cmd2, level, father);
+		return run_pipeline(c, level, father);
+
+	case OP_FOR:
+		return run_for(c, level);
+
+	case OP_WHILE:
+		return run_while(c, level);
 
 	default:
 		return SHELL_EXIT;
@@ -3,6 +3,8 @@
 #ifndef _CMD_H
 #define _CMD_H
 
+#include <stddef.h>
+
 #include "../util/parser/parser.h"
 
 #define SHELL_EXIT -100
@@ -12,4 +14,29 @@
  */
 int parse_command(command_t *cmd, int level, command_t *father);
 
+/* Names of the internal commands, NULL terminated. */
+extern const char * const builtin_names[];
+
+/**
+ * Tell if `verb` names an internal command.
+ */
+bool is_builtin(word_t *verb);
+
+/**
+ * Tell if a node joins two commands with `;`, `&&` or `||`.
+ */
+bool is_list(command_t *c);
+
+/**
+ * Tell if a simple command runs in-process when it is a pipeline stage
+ * next to another such command (see ring.h).
+ */
+bool is_ring_builtin(simple_command_t *s);
+
+/**
+ * Store the stages of the pipeline `c` in `stages` (if not NULL) from
+ * index `n`. Returns the index after the last stage.
+ */
+size_t pipeline_stages(command_t *c, command_t **stages, size_t n);
+
 #endif /* _CMD_H */
@@ -0,0 +1,444 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "complete.h"
+#include "cmd.h"
+#include "utils.h"
+
+#define DEFAULT_PATH	"/usr/local/bin:/usr/bin:/bin"
+
+/**
+ * Prefix trie of the command names. `refs` counts the sources (PATH
+ * directories or the builtin list) providing the name that ends in a
+ * node, `live` the distinct names with refs > 0 in the node's subtree, so
+ * removed names do not show up without having to prune the trie.
+ */
+struct trie_node {
+	struct trie_node *child;
+	struct trie_node *sibling;
+	unsigned int live;
+	unsigned int refs;
+	char c;
+};
+
+/**
+ * A PATH directory and the names it contributed to the trie.
+ */
+struct path_dir {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	bool scanned;
+	char **names;
+	size_t count;
+};
+
+struct candidates {
+	char **names;
+	size_t count;
+	size_t max;
+};
+
+static struct trie_node trie_root;
+static bool builtins_added;
+
+static char *path_value;
+static struct path_dir *path_dirs;
+static size_t npath_dirs;
+
+/**
+ * Add (delta == 1) or remove (delta == -1) a reference to a name. Sibling
+ * lists are kept sorted, so walking the trie yields sorted names.
+ */
+static void trie_update(const char *name, int delta)
+{
+	struct trie_node *node = &trie_root, **link, *n;
+	const char *p;
+
+	for (p = name; *p != '\0'; p++) {
+		link = &node->child;
+		while (*link != NULL && (unsigned char)(*link)->c < (unsigned char)*p)
+			link = &(*link)->sibling;
+
+		if (*link == NULL || (*link)->c != *p) {
+			n = calloc(1, sizeof(*n));
+			DIE(n == NULL, "calloc");
+			n->c = *p;
+			n->sibling = *link;
+			*link = n;
+		}
+
+		node = *link;
+	}
+
+	node->refs += delta;
+
+	/* The name only appears or disappears with its first reference. */
+	if ((delta > 0 && node->refs != 1) || (delta < 0 && node->refs != 0))
+		return;
+
+	node = &trie_root;
+	node->live += delta;
+	for (p = name; *p != '\0'; p++) {
+		for (n = node->child; n->c != *p; n = n->sibling)
+			;
+		node = n;
+		node->live += delta;
+	}
+}
+
+static struct trie_node *trie_find(const char *prefix)
+{
+	struct trie_node *node = &trie_root, *n;
+
+	for (; *prefix != '\0'; prefix++) {
+		for (n = node->child; n != NULL && n->c != *prefix; n = n->sibling)
+			;
+		if (n == NULL || n->live == 0)
+			return NULL;
+		node = n;
+	}
+
+	return node;
+}
+
+static void forget_dir(struct path_dir *d)
+{
+	size_t i;
+
+	for (i = 0; i < d->count; i++) {
+		trie_update(d->names[i], -1);
+		free(d->names[i]);
+	}
+
+	free(d->names);
+	d->names = NULL;
+	d->count = 0;
+	d->scanned = false;
+}
+
+static void scan_dir(struct path_dir *d, const struct stat *st)
+{
+	struct dirent *ent;
+	struct stat est;
+	size_t size = 0;
+	DIR *dir;
+
+	d->dev = st->st_dev;
+	d->ino = st->st_ino;
+	d->mtime = st->st_mtim;
+	d->scanned = true;
+
+	dir = opendir(d->path);
+	if (dir == NULL)
+		return;
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		if (ent->d_type == DT_DIR)
+			continue;
+		if (ent->d_type != DT_REG && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN)
+			continue;
+		if (faccessat(dirfd(dir), ent->d_name, X_OK, 0) != 0)
+			continue;
+		if (ent->d_type != DT_REG &&
+		    (fstatat(dirfd(dir), ent->d_name, &est, 0) != 0 || S_ISDIR(est.st_mode)))
+			continue;
+
+		if (d->count == size) {
+			size = size ? 2 * size : 256;
+			d->names = realloc(d->names, size * sizeof(*d->names));
+			DIE(d->names == NULL, "realloc");
+		}
+
+		d->names[d->count] = strdup(ent->d_name);
+		DIE(d->names[d->count] == NULL, "strdup");
+		trie_update(d->names[d->count], 1);
+		d->count++;
+	}
+
+	closedir(dir);
+}
+
+static void set_path(const char *path)
+{
+	char *copy, *dir, *saveptr = NULL;
+	size_t i;
+
+	for (i = 0; i < npath_dirs; i++) {
+		forget_dir(&path_dirs[i]);
+		free(path_dirs[i].path);
+	}
+	free(path_dirs);
+	path_dirs = NULL;
+	npath_dirs = 0;
+
+	free(path_value);
+	path_value = strdup(path);
+	DIE(path_value == NULL, "strdup");
+
+	copy = strdup(path);
+	DIE(copy == NULL, "strdup");
+
+	for (dir = strtok_r(copy, ":", &saveptr); dir != NULL;
+	     dir = strtok_r(NULL, ":", &saveptr)) {
+		/* Skip duplicates, they would only add references. */
+		for (i = 0; i < npath_dirs; i++)
+			if (strcmp(path_dirs[i].path, dir) == 0)
+				break;
+		if (i < npath_dirs)
+			continue;
+
+		path_dirs = realloc(path_dirs, (npath_dirs + 1) * sizeof(*path_dirs));
+		DIE(path_dirs == NULL, "realloc");
+		memset(&path_dirs[npath_dirs], 0, sizeof(*path_dirs));
+		path_dirs[npath_dirs].path = strdup(dir);
+		DIE(path_dirs[npath_dirs].path == NULL, "strdup");
+		npath_dirs++;
+	}
+
+	free(copy);
+}
+
+/**
+ * Bring the trie up to date: only the directories whose mtime changed
+ * since the last scan are read again.
+ */
+static void refresh_commands(void)
+{
+	const char *path = getenv("PATH");
+	struct path_dir *d;
+	struct stat st;
+	size_t i;
+
+	if (!builtins_added) {
+		for (i = 0; builtin_names[i] != NULL; i++)
+			trie_update(builtin_names[i], 1);
+		builtins_added = true;
+	}
+
+	if (path == NULL)
+		path = DEFAULT_PATH;
+	if (path_value == NULL || strcmp(path, path_value) != 0)
+		set_path(path);
+
+	for (i = 0; i < npath_dirs; i++) {
+		d = &path_dirs[i];
+		if (stat(d->path, &st) == -1) {
+			if (d->scanned)
+				forget_dir(d);
+			continue;
+		}
+
+		if (d->scanned && d->dev == st.st_dev && d->ino == st.st_ino &&
+		    d->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    d->mtime.tv_nsec == st.st_mtim.tv_nsec)
+			continue;
+
+		forget_dir(d);
+		scan_dir(d, &st);
+	}
+}
+
+static void add_candidate(struct candidates *c, const char *prefix,
+			  size_t prefix_len, const char *name, size_t name_len,
+			  bool slash)
+{
+	char *s;
+
+	if (c->count++ >= c->max)
+		return;
+
+	s = malloc(prefix_len + name_len + 2);
+	DIE(s == NULL, "malloc");
+	memcpy(s, prefix, prefix_len);
+	memcpy(s + prefix_len, name, name_len);
+	if (slash)
+		s[prefix_len + name_len++] = '/';
+	s[prefix_len + name_len] = '\0';
+
+	c->names[c->count - 1] = s;
+}
+
+static void collect(struct trie_node *node, char *buf, size_t len,
+		    struct candidates *c)
+{
+	struct trie_node *n;
+
+	if (node->refs > 0)
+		add_candidate(c, "", 0, buf, len, false);
+
+	for (n = node->child; n != NULL && c->count < c->max; n = n->sibling) {
+		if (n->live == 0)
+			continue;
+		buf[len] = n->c;
+		collect(n, buf, len + 1, c);
+	}
+}
+
+static size_t complete_command(const char *word, char **common,
+			       struct candidates *c)
+{
+	struct trie_node *node, *n, *next;
+	size_t len = strlen(word), size = len + 256;
+	char *buf;
+
+	refresh_commands();
+
+	node = trie_find(word);
+	if (node == NULL)
+		return 0;
+
+	buf = malloc(size);
+	DIE(buf == NULL, "malloc");
+	memcpy(buf, word, len);
+
+	/* Follow the only live child as long as no name ends on the way. */
+	while (node->refs == 0) {
+		next = NULL;
+		for (n = node->child; n != NULL; n = n->sibling) {
+			if (n->live == 0)
+				continue;
+			if (next != NULL)
+				break;
+			next = n;
+		}
+		if (next == NULL || n != NULL)
+			break;
+
+		if (len + 1 == size) {
+			size *= 2;
+			buf = realloc(buf, size);
+			DIE(buf == NULL, "realloc");
+		}
+		buf[len++] = next->c;
+		node = next;
+	}
+
+	*common = strndup(buf, len);
+	DIE(*common == NULL, "strndup");
+
+	/* Names are bounded by NAME_MAX, the prefix walk is done. */
+	buf = realloc(buf, len + NAME_MAX + 1);
+	DIE(buf == NULL, "realloc");
+	collect(node, buf, len, c);
+	free(buf);
+
+	/* collect() stops at max, the live counter has the total. */
+	return node->live;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static size_t complete_file(const char *word, char **common,
+			    struct candidates *c)
+{
+	const char *slash = strrchr(word, '/');
+	const char *base = slash ? slash + 1 : word;
+	size_t dir_len = base - word, base_len = strlen(base);
+	size_t common_len = 0, size = 0;
+	struct dirent *ent;
+	struct stat st;
+	char *dir_path;
+	DIR *dir;
+	bool is_dir;
+
+	dir_path = dir_len ? strndup(word, dir_len) : strdup(".");
+	DIE(dir_path == NULL, "strdup");
+	dir = opendir(dir_path);
+	free(dir_path);
+	if (dir == NULL)
+		return 0;
+
+	/* Directory sizes are moderate, keep all the names to sort them. */
+	c->max = (size_t)-1;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+		if (ent->d_name[0] == '.' && base[0] != '.')
+			continue;
+		if (strncmp(ent->d_name, base, base_len) != 0)
+			continue;
+
+		is_dir = ent->d_type == DT_DIR;
+		if (ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN)
+			is_dir = fstatat(dirfd(dir), ent->d_name, &st, 0) == 0 &&
+				 S_ISDIR(st.st_mode);
+
+		if (c->count == size) {
+			size = size ? 2 * size : 64;
+			c->names = realloc(c->names, size * sizeof(*c->names));
+			DIE(c->names == NULL, "realloc");
+		}
+		add_candidate(c, word, dir_len, ent->d_name, strlen(ent->d_name), is_dir);
+	}
+	closedir(dir);
+
+	if (c->count == 0)
+		return 0;
+
+	qsort(c->names, c->count, sizeof(*c->names), compare_names);
+
+	/* The common prefix of a sorted list is the one of its ends. */
+	while (c->names[0][common_len] != '\0' &&
+	       c->names[0][common_len] == c->names[c->count - 1][common_len])
+		common_len++;
+	*common = strndup(c->names[0], common_len);
+	DIE(*common == NULL, "strndup");
+
+	return c->count;
+}
+
+size_t complete_word(const char *word, bool command, char **common,
+		     char ***matches, size_t max)
+{
+	struct candidates c = { NULL, 0, max };
+	size_t total, i;
+
+	*common = NULL;
+	*matches = NULL;
+
+	if (command && strchr(word, '/') == NULL) {
+		c.names = calloc(max + 1, sizeof(*c.names));
+		DIE(c.names == NULL, "calloc");
+		total = complete_command(word, common, &c);
+	} else {
+		total = complete_file(word, common, &c);
+		/* Trim to what the caller asked for. */
+		for (i = max; i < c.count; i++)
+			free(c.names[i]);
+	}
+
+	if (total == 0) {
+		free(c.names);
+		return 0;
+	}
+
+	*matches = c.names;
+	return total;
+}
+
+void complete_free(char **matches, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		free(matches[i]);
+	free(matches);
+}
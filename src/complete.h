@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _COMPLETE_H
+#define _COMPLETE_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Find the completions of `word`: command names from PATH (and the
+ * builtins) if `command` is true, file names otherwise. Directories are
+ * returned with a trailing '/'.
+ *
+ * `common` receives the longest prefix shared by all the candidates and
+ * `matches` a sorted array of at most `max` of them. The return value is
+ * the total number of candidates, which can be larger than `max`.
+ */
+size_t complete_word(const char *word, bool command, char **common,
+		     char ***matches, size_t max);
+
+/**
+ * Free an array returned by complete_word().
+ */
+void complete_free(char **matches, size_t count);
+
+#endif /* _COMPLETE_H */
@@ -0,0 +1,506 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "explain.h"
+#include "cmd.h"
+#include "fanout.h"
+#include "keeporder.h"
+#include "affinity.h"
+#include "meter.h"
+#include "utils.h"
+
+#define INDENT		4
+
+struct plan {
+	unsigned long forks;
+	unsigned long execs;
+	unsigned long pipes;
+	unsigned long opens;
+};
+
+static void explain_node(command_t *c, int level, struct plan *p);
+static void explain_simple(simple_command_t *s, int level, struct plan *p);
+
+static void indent(int level)
+{
+	printf("%*s", INDENT * level, "");
+}
+
+static void print_words(word_t *w)
+{
+	for (; w != NULL; w = w->next_word) {
+		putchar(' ');
+		print_word(stdout, w);
+	}
+}
+
+/**
+ * Tell if stdout and stderr go to the same file, opened once (&> or the
+ * same literal name); names with variables are assumed to differ.
+ */
+static bool same_target(word_t *out, word_t *err)
+{
+	if (out == NULL || err == NULL)
+		return false;
+	if (out == err)
+		return true;
+
+	return out->next_part == NULL && err->next_part == NULL &&
+	       !out->expand && !err->expand && !out->arith && !err->arith &&
+	       strcmp(out->string, err->string) == 0;
+}
+
+/**
+ * Print the copy of a stream redirected several times, made by a child
+ * of the shell (see fanout.h).
+ */
+static void explain_fanout(word_t *targets, bool append, const char *what,
+			   int level, struct plan *p)
+{
+	indent(level);
+	printf("pipe as %s, a forked copier duplicates it to", what);
+	for (; targets != NULL; targets = targets->next_word) {
+		putchar(' ');
+		print_word(stdout, targets);
+		p->opens++;
+	}
+	printf(" (%s, tee and splice)\n", append ? "appending" : "writing");
+
+	p->forks++;
+	p->pipes++;
+	p->opens += 2;
+}
+
+/**
+ * List the redirections a simple command opens; like run_simple(), every
+ * output target gets a copy, the first input is used.
+ */
+static void explain_redirects(simple_command_t *s, int level, struct plan *p)
+{
+	bool shared = same_target(s->out, s->err);
+
+	if (fanout_needed(s->out) || (fanout_needed(s->err) && s->err != s->out)) {
+		shared = s->out == s->err;
+		if (fanout_needed(s->out))
+			explain_fanout(s->out, s->io_flags & IO_OUT_APPEND,
+				       shared ? "stdout and stderr" : "stdout",
+				       level, p);
+		if (fanout_needed(s->err) && !shared)
+			explain_fanout(s->err, s->io_flags & IO_ERR_APPEND,
+				       "stderr", level, p);
+	}
+
+	if (s->in != NULL) {
+		indent(level);
+		printf("open ");
+		print_word(stdout, s->in);
+		printf(" for reading as stdin\n");
+		p->opens++;
+	}
+
+	if (s->out != NULL && !fanout_needed(s->out)) {
+		indent(level);
+		printf("open ");
+		print_word(stdout, s->out);
+		printf(" for %s as stdout%s\n",
+		       s->io_flags & IO_OUT_APPEND ? "appending" : "writing",
+		       shared ? " and stderr" : "");
+		p->opens++;
+	}
+
+	if (s->err != NULL && !shared && !fanout_needed(s->err)) {
+		indent(level);
+		printf("open ");
+		print_word(stdout, s->err);
+		printf(" for %s as stderr\n",
+		       s->io_flags & IO_ERR_APPEND ? "appending" : "writing");
+		p->opens++;
+	}
+}
+
+/**
+ * Print the command run by timeout, which gets the same redirections;
+ * like shell_timeout(), an invalid command line runs nothing.
+ */
+static void explain_timeout(simple_command_t *s, int level, struct plan *p)
+{
+	word_t *word = s->params;
+	simple_command_t inner;
+
+	if (word != NULL && is_literal(word, "-k") && word->next_word != NULL)
+		word = word->next_word->next_word;
+
+	if (word == NULL || word->next_word == NULL) {
+		printf("builtin timeout: usage error, nothing runs\n");
+		return;
+	}
+
+	printf("builtin timeout ");
+	print_word(stdout, word);
+	printf(": the command gets a deadline, in a process group of its own\n");
+
+	inner = *s;
+	inner.verb = word->next_word;
+	inner.params = inner.verb->next_word;
+	explain_simple(&inner, level + 1, p);
+}
+
+/**
+ * Print the command run by sched, which only changes how it is scheduled.
+ */
+static void explain_sched(simple_command_t *s, int level, struct plan *p)
+{
+	struct sched_settings settings = SCHED_SETTINGS_INIT;
+	simple_command_t inner;
+	word_t *word;
+
+	word = sched_parse(s->params, &settings);
+	if (word == NULL) {
+		printf("builtin sched: usage error, nothing runs\n");
+		return;
+	}
+
+	printf("builtin sched: the command gets the scheduling settings before exec\n");
+
+	inner = *s;
+	inner.verb = word;
+	inner.params = word->next_word;
+	explain_simple(&inner, level + 1, p);
+}
+
+/**
+ * Print the command run by memo on a cache miss; like shell_memo(), only
+ * external commands are cached.
+ */
+static void explain_memo(simple_command_t *s, int level, struct plan *p)
+{
+	word_t *word = s->params;
+	simple_command_t inner;
+
+	if (word != NULL && is_literal(word, "--stats")) {
+		printf("builtin memo: prints the cache counters, no fork\n");
+		return;
+	}
+
+	while (word != NULL && (is_literal(word, "-i") || is_literal(word, "-e")) &&
+	       word->next_word != NULL)
+		word = word->next_word->next_word;
+
+	if (word == NULL || is_assignment(word)) {
+		printf("builtin memo: usage error, nothing runs\n");
+		return;
+	}
+
+	printf("builtin memo: replays the cached output, on a miss runs\n");
+
+	inner = *s;
+	inner.verb = word;
+	inner.params = word->next_word;
+	explain_simple(&inner, level + 1, p);
+}
+
+static void explain_simple(simple_command_t *s, int level, struct plan *p)
+{
+	const char *verb = s->verb->string;
+
+	indent(level);
+
+	if (strcmp(verb, "exit") == 0 || strcmp(verb, "quit") == 0) {
+		printf("builtin %s: the shell exits\n", verb);
+		return;
+	}
+
+	if (strcmp(verb, "cd") == 0) {
+		printf("builtin cd");
+		print_words(s->params);
+		printf(": no fork\n");
+		/* cd opens and truncates its output target. */
+		if (s->out != NULL) {
+			indent(level + 1);
+			printf("open ");
+			print_word(stdout, s->out);
+			printf(" for writing\n");
+			p->opens++;
+		}
+		return;
+	}
+
+	if (strcmp(verb, "parallel") == 0) {
+		printf("builtin parallel");
+		print_words(s->params);
+		printf(": one fork per input line\n");
+		indent(level + 1);
+		printf("open /dev/null as stdin of the items\n");
+		p->opens++;
+		if (s->in != NULL) {
+			indent(level + 1);
+			printf("open ");
+			print_word(stdout, s->in);
+			printf(" to read the items\n");
+			p->opens++;
+		}
+		indent(level + 1);
+		printf("each item runs the template as a line of its own\n");
+		return;
+	}
+
+	if (strcmp(verb, "fdcache") == 0 || strcmp(verb, "stats") == 0) {
+		printf("builtin %s: no fork\n", verb);
+		if (strcmp(verb, "stats") == 0 && s->out != NULL) {
+			indent(level + 1);
+			printf("open ");
+			print_word(stdout, s->out);
+			printf(" for %s\n", s->io_flags & IO_OUT_APPEND ?
+			       "appending" : "writing");
+			p->opens++;
+		}
+		return;
+	}
+
+	if (strcmp(verb, "read") == 0) {
+		printf("builtin read: no fork, sets the variables in the shell\n");
+		if (s->in != NULL) {
+			indent(level + 1);
+			printf("open ");
+			print_word(stdout, s->in);
+			printf(" for reading\n");
+			p->opens++;
+		}
+		return;
+	}
+
+	if (strcmp(verb, "timeout") == 0) {
+		explain_timeout(s, level, p);
+		return;
+	}
+
+	if (strcmp(verb, "memo") == 0) {
+		explain_memo(s, level, p);
+		return;
+	}
+
+	if (strcmp(verb, "sched") == 0) {
+		explain_sched(s, level, p);
+		return;
+	}
+
+	if (s->params == NULL && is_assignment(s->verb)) {
+		printf("assignment ");
+		print_word(stdout, s->verb);
+		printf(": no fork\n");
+		return;
+	}
+
+	printf("exec ");
+	print_word(stdout, s->verb);
+	print_words(s->params);
+	putchar('\n');
+
+	indent(level + 1);
+	printf("fork\n");
+	explain_redirects(s, level + 1, p);
+	indent(level + 1);
+	printf("exec in the child, the shell waits for it\n");
+
+	p->forks++;
+	p->execs++;
+}
+
+/**
+ * Print a command run in a forked subshell, as by run_in_parallel() and
+ * run_on_pipe().
+ */
+static void explain_subshell(command_t *c, int level, const char *what,
+			     struct plan *p)
+{
+	indent(level);
+	printf("fork a subshell for %s\n", what);
+	p->forks++;
+	explain_node(c, level + 1, p);
+}
+
+/**
+ * Print a pipeline with adjacent internal commands the way run_pipeline()
+ * splits it: each run of them in one process (none if there are only
+ * internal commands), the other stages in subshells of their own.
+ */
+static bool explain_pipeline(command_t *c, int level, struct plan *p)
+{
+	size_t n = pipeline_stages(c, NULL, 0), i, end, runs = 0, segments = 0;
+	command_t **cmds = malloc(n * sizeof(*cmds));
+	bool all;
+
+	DIE(cmds == NULL, "malloc");
+	pipeline_stages(c, cmds, 0);
+
+	for (i = 0; i < n; i = end) {
+		end = i + 1;
+		while (cmds[i]->op == OP_NONE && is_ring_builtin(cmds[i]->scmd) &&
+		       end < n && cmds[end]->op == OP_NONE &&
+		       is_ring_builtin(cmds[end]->scmd))
+			end++;
+		runs += end - i > 1;
+		segments++;
+	}
+
+	if (runs == 0) {
+		free(cmds);
+		return false;
+	}
+
+	all = segments == 1;
+	indent(level);
+	printf("pipeline of %zu stages: %zu kernel pipe%s, internal commands next to each other share %s\n",
+	       n, segments - 1, segments == 2 ? "" : "s",
+	       all ? "the shell" : "a subshell");
+	p->pipes += segments - 1;
+	p->opens += 2 * (segments - 1);
+
+	for (i = 0; i < n; i = end) {
+		end = i + 1;
+		while (cmds[i]->op == OP_NONE && is_ring_builtin(cmds[i]->scmd) &&
+		       end < n && cmds[end]->op == OP_NONE &&
+		       is_ring_builtin(cmds[end]->scmd))
+			end++;
+
+		if (end - i == 1) {
+			explain_subshell(cmds[i], level + 1, "a stage", p);
+			continue;
+		}
+
+		indent(level + 1);
+		if (all) {
+			printf("run in the shell, as coroutines connected by ring buffers\n");
+		} else {
+			printf("fork a subshell running %zu stages as coroutines connected by ring buffers\n",
+			       end - i);
+			p->forks++;
+		}
+		for (; i < end; i++)
+			explain_node(cmds[i], level + 2, p);
+	}
+
+	free(cmds);
+	return true;
+}
+
+static void explain_list_op(command_t *c, int level)
+{
+	indent(level);
+
+	switch (c->op) {
+	case OP_SEQUENTIAL:
+		printf("sequence (;): one after the other, no fork\n");
+		break;
+	case OP_CONDITIONAL_ZERO:
+		printf("and (&&): the right side runs if the left one succeeds\n");
+		break;
+	default:
+		printf("or (||): the right side runs if the left one fails\n");
+		break;
+	}
+}
+
+/**
+ * Print a list the way run_list() walks it, down the left side of the
+ * tree and back up, instead of recursing once per command. The commands
+ * joined by the same operator are printed under one line.
+ */
+static void explain_list(command_t *c, int level, struct plan *p)
+{
+	command_t *node = c;
+
+	explain_list_op(node, level);
+	while (is_list(node->cmd1)) {
+		if (node->cmd1->op != node->op)
+			explain_list_op(node->cmd1, ++level);
+		node = node->cmd1;
+	}
+
+	explain_node(node->cmd1, level + 1, p);
+
+	for (;;) {
+		explain_node(node->cmd2, level + 1, p);
+		if (node == c)
+			break;
+		if (node->up->op != node->op)
+			level--;
+		node = node->up;
+	}
+}
+
+static void explain_node(command_t *c, int level, struct plan *p)
+{
+	switch (c->op) {
+	case OP_NONE:
+		explain_simple(c->scmd, level, p);
+		break;
+	case OP_SEQUENTIAL:
+	case OP_CONDITIONAL_ZERO:
+	case OP_CONDITIONAL_NZERO:
+		explain_list(c, level, p);
+		break;
+	case OP_PARALLEL:
+		indent(level);
+		printf("parallel (&): both sides at the same time\n");
+		if (keep_order_enabled()) {
+			indent(level + 1);
+			printf("2 memory files per side for stdout and stderr, copied out in order\n");
+			p->opens += 4;
+		}
+		explain_subshell(c->cmd1, level + 1, "the left side", p);
+		explain_subshell(c->cmd2, level + 1, "the right side", p);
+		break;
+	case OP_PIPE:
+		if (explain_pipeline(c, level, p))
+			break;
+		indent(level);
+		if (meter_enabled()) {
+			printf("pipe (|): 2 pipes with a relay process metering the throughput\n");
+			p->pipes += 2;
+			p->opens += 4;
+			p->forks++;
+		} else {
+			printf("pipe (|): 2 descriptors\n");
+			p->pipes++;
+			p->opens += 2;
+		}
+		explain_subshell(c->cmd1, level + 1, "the left side, stdout to the pipe", p);
+		explain_subshell(c->cmd2, level + 1, "the right side, stdin from the pipe", p);
+		break;
+	case OP_FOR:
+		indent(level);
+		printf("for ");
+		print_word(stdout, c->scmd->verb);
+		printf(" in");
+		print_words(c->scmd->params);
+		printf(": the body runs once per word, no fork\n");
+		explain_node(c->cmd1, level + 1, p);
+		break;
+	case OP_WHILE:
+		indent(level);
+		printf("while: the condition, then the body, until the condition fails\n");
+		explain_node(c->cmd1, level + 1, p);
+		explain_node(c->cmd2, level + 1, p);
+		break;
+	default:
+		break;
+	}
+}
+
+void explain_command(command_t *root)
+{
+	struct plan p = { 0 };
+
+	explain_node(root, 0, &p);
+
+	printf("total: %lu fork%s, %lu exec%s, %lu pipe%s, %lu descriptor%s opened\n",
+	       p.forks, p.forks == 1 ? "" : "s",
+	       p.execs, p.execs == 1 ? "" : "s",
+	       p.pipes, p.pipes == 1 ? "" : "s",
+	       p.opens, p.opens == 1 ? "" : "s");
+	fflush(stdout);
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _EXPLAIN_H
+#define _EXPLAIN_H
+
+#include "../util/parser/parser.h"
+
+/**
+ * Plan mode (--explain): print what running a command tree would cost
+ * instead of running it.
+ *
+ * Every node of the tree is listed with the processes it forks, the
+ * pipes it creates, the redirection targets it opens and whether its
+ * simple commands are internal or executed. Nothing is run and no
+ * variable is expanded; words are printed as they were written.
+ *
+ * The totals count loop bodies once and both sides of && and ||.
+ */
+void explain_command(command_t *root);
+
+#endif /* _EXPLAIN_H */
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fanout.h"
+#include "stats.h"
+#include "utils.h"
+
+/* Bytes moved per round, at most the size of the pipes. */
+#define FANOUT_CHUNK		(256 * 1024)
+#define COPY_BLOCK		(64 * 1024)
+
+struct target {
+	char *name;
+	int fd;		/* -1 once writing to it failed */
+};
+
+static char copy_buf[COPY_BLOCK];
+
+/**
+ * Move up to `len` bytes from the pipe `from` to the target with read()
+ * and write(), for targets splice() does not support.
+ */
+static ssize_t copy_user(int from, struct target *t, size_t len)
+{
+	ssize_t rc, done = 0, n;
+
+	n = read(from, copy_buf, len < COPY_BLOCK ? len : COPY_BLOCK);
+	if (n <= 0)
+		return n;
+
+	while (t->fd >= 0 && done < n) {
+		rc = write(t->fd, copy_buf + done, n - done);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0) {
+			perror(t->name);
+			close(t->fd);
+			t->fd = -1;
+			break;
+		}
+		done += rc;
+	}
+
+	return n;
+}
+
+/**
+ * Move exactly `len` bytes from the pipe `from` to the target. The bytes
+ * are consumed even if the target failed, so the pipes stay in step.
+ */
+static void drain(int from, struct target *t, size_t len)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		if (t->fd < 0) {
+			rc = copy_user(from, t, len);
+		} else {
+			rc = splice(from, NULL, t->fd, NULL, len,
+				    SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (rc < 0 && errno == EINVAL)
+				rc = copy_user(from, t, len);
+		}
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0 && t->fd >= 0) {
+			perror(t->name);
+			close(t->fd);
+			t->fd = -1;
+			continue;
+		}
+		DIE(rc <= 0, "splice");
+		len -= rc;
+	}
+}
+
+static ssize_t tee_retry(int from, int to, size_t len)
+{
+	ssize_t rc;
+
+	do {
+		rc = tee(from, to, len, 0);
+	} while (rc < 0 && errno == EINTR);
+	DIE(rc < 0, "tee");
+
+	return rc;
+}
+
+/**
+ * Copy everything written to the pipe `in` to all of the targets. Each
+ * round duplicates the data waiting in `in` into `copy` for every target
+ * but the last one, which gets the original.
+ */
+static void run_copy(int in, struct target *targets, size_t ntargets)
+{
+	size_t i, last = ntargets - 1;
+	ssize_t len;
+	int copy[2];
+
+	DIE(pipe(copy) < 0, "pipe");
+
+	/* A tee() must fit whole in the empty copy pipe. */
+	fcntl(in, F_SETPIPE_SZ, FANOUT_CHUNK);
+	fcntl(copy[PIPE_WRITE], F_SETPIPE_SZ, FANOUT_CHUNK);
+	if (fcntl(copy[PIPE_WRITE], F_GETPIPE_SZ) < fcntl(in, F_GETPIPE_SZ))
+		fcntl(in, F_SETPIPE_SZ, fcntl(copy[PIPE_WRITE], F_GETPIPE_SZ));
+
+	/* Blocks until there is data; 0 once the command closed its end. */
+	while ((len = tee_retry(in, copy[PIPE_WRITE], FANOUT_CHUNK)) > 0) {
+		drain(copy[PIPE_READ], &targets[0], len);
+
+		for (i = 1; i < last; i++) {
+			DIE(tee_retry(in, copy[PIPE_WRITE], len) != len, "tee");
+			drain(copy[PIPE_READ], &targets[i], len);
+		}
+
+		drain(in, &targets[last], len);
+	}
+
+	close(copy[PIPE_READ]);
+	close(copy[PIPE_WRITE]);
+}
+
+static void close_targets(struct target *targets, size_t ntargets)
+{
+	size_t i;
+
+	for (i = 0; i < ntargets; i++) {
+		if (targets[i].fd >= 0)
+			close(targets[i].fd);
+		free(targets[i].name);
+	}
+	free(targets);
+}
+
+bool fanout_needed(word_t *targets)
+{
+	return targets != NULL && targets->next_word != NULL;
+}
+
+bool fanout_start(word_t *targets, bool append, struct fanout *f)
+{
+	struct target *t = NULL;
+	size_t n = 0, i;
+	word_t *w;
+	int fds[2];
+
+	for (w = targets; w != NULL; w = w->next_word)
+		n++;
+	t = calloc(n, sizeof(*t));
+	DIE(t == NULL, "calloc");
+
+	/*
+	 * splice() refuses O_APPEND descriptors; appending is done from the
+	 * end of the file instead.
+	 */
+	for (i = 0, w = targets; w != NULL; i++, w = w->next_word) {
+		t[i].name = get_word(w);
+		t[i].fd = open(t[i].name, O_WRONLY | O_CREAT |
+			       (append ? 0 : O_TRUNC), 0644);
+		if (t[i].fd < 0) {
+			perror(t[i].name);
+			close_targets(t, i + 1);
+			return false;
+		}
+		if (append)
+			lseek(t[i].fd, 0, SEEK_END);
+	}
+
+	/* Only the command's stdout or stderr may keep the pipe open. */
+	DIE(pipe2(fds, O_CLOEXEC) < 0, "pipe2");
+
+	f->pid = stats_fork();
+	DIE(f->pid < 0, "fork");
+	if (f->pid == 0) {
+		close(fds[PIPE_WRITE]);
+		run_copy(fds[PIPE_READ], t, n);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(fds[PIPE_READ]);
+	f->fd = fds[PIPE_WRITE];
+	close_targets(t, n);
+
+	return true;
+}
+
+void fanout_finish(struct fanout *f)
+{
+	if (f->pid < 0)
+		return;
+
+	close(f->fd);
+	stats_waitpid(f->pid, NULL, 0);
+	f->pid = -1;
+	f->fd = -1;
+}
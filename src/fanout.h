@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Output redirected to several targets, as in cat >out1 >out2: every
+ * target gets all of the output, like with zsh's MULTIOS.
+ *
+ * The command writes to a pipe. A child of the shell duplicates the
+ * pipe into each target with tee(2) and moves the data with splice(2),
+ * so it never goes through user space. Targets that do not support
+ * splice (terminals, for instance) fall back to read() and write().
+ */
+
+struct fanout {
+	pid_t pid;	/* the process copying the output, -1 if none */
+	int fd;		/* write end of the pipe, for the command */
+};
+
+/**
+ * Tell if a redirection list has more than one target.
+ */
+bool fanout_needed(word_t *targets);
+
+/**
+ * Open every target of `targets`, appending to them or truncating them,
+ * and start copying to them. Returns false, after reporting the error,
+ * if a target cannot be opened; nothing is started then.
+ */
+bool fanout_start(word_t *targets, bool append, struct fanout *f);
+
+/**
+ * Close the write end held by the shell and wait until everything the
+ * command wrote has reached the targets.
+ */
+void fanout_finish(struct fanout *f);
+
+#endif /* _FANOUT_H */
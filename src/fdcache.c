@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fdcache.h"
+#include "utils.h"
+
+#define FDCACHE_VAR		"MINISHELL_FD_CACHE"
+#define FDCACHE_MAX		256
+
+struct fd_entry {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	int fd;
+	unsigned long used;
+};
+
+static struct fd_entry entries[FDCACHE_MAX];
+static size_t nentries;
+static unsigned long use_count;
+
+static size_t cache_size(void)
+{
+	const char *value = getenv(FDCACHE_VAR);
+	long size;
+
+	if (value == NULL)
+		return 0;
+
+	size = strtol(value, NULL, 10);
+	if (size <= 0)
+		return 0;
+
+	return size < FDCACHE_MAX ? size : FDCACHE_MAX;
+}
+
+static void drop(size_t i)
+{
+	close(entries[i].fd);
+	free(entries[i].path);
+	entries[i] = entries[--nentries];
+}
+
+static void drop_lru(void)
+{
+	size_t i, lru = 0;
+
+	for (i = 1; i < nentries; i++)
+		if (entries[i].used < entries[lru].used)
+			lru = i;
+	drop(lru);
+}
+
+void fdcache_flush(void)
+{
+	while (nentries > 0)
+		drop(nentries - 1);
+}
+
+int fdcache_open(const char *path)
+{
+	size_t size = cache_size(), i;
+	struct stat st;
+	int fd;
+
+	if (size == 0) {
+		fdcache_flush();
+		return -1;
+	}
+
+	/* The size may have been lowered since the last call. */
+	while (nentries > size)
+		drop_lru();
+
+	for (i = 0; i < nentries; i++) {
+		if (strcmp(entries[i].path, path) != 0)
+			continue;
+
+		/* Renamed or removed since it was opened. */
+		if (stat(path, &st) < 0 || st.st_dev != entries[i].dev ||
+		    st.st_ino != entries[i].ino) {
+			drop(i);
+			break;
+		}
+
+		entries[i].used = ++use_count;
+		return entries[i].fd;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	DIE(fstat(fd, &st) < 0, "fstat");
+
+	if (nentries == size)
+		drop_lru();
+
+	entries[nentries].path = strdup(path);
+	DIE(entries[nentries].path == NULL, "strdup");
+	entries[nentries].dev = st.st_dev;
+	entries[nentries].ino = st.st_ino;
+	entries[nentries].fd = fd;
+	entries[nentries].used = ++use_count;
+
+	return entries[nentries++].fd;
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _FDCACHE_H
+#define _FDCACHE_H
+
+/**
+ * Cache of append-mode redirection targets.
+ *
+ * With MINISHELL_FD_CACHE set to N > 0, the shell keeps up to N targets
+ * of >> redirections open (least recently used ones are closed first),
+ * so running `cmd >> log` again only dup2()s the descriptor in the child.
+ * Entries are keyed by path and checked against the device and inode the
+ * path currently refers to.
+ *
+ * The cache is flushed by cd, by truncating redirections and by the
+ * fdcache internal command.
+ */
+
+/**
+ * Get the cached descriptor for appending to `path`, opening and caching
+ * it if needed. Returns -1 if the cache is disabled or the file cannot
+ * be opened; the caller then opens the file itself.
+ */
+int fdcache_open(const char *path);
+
+/**
+ * Close all the cached descriptors.
+ */
+void fdcache_flush(void);
+
+#endif /* _FDCACHE_H */
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <unistd.h>
+
+#include "keeporder.h"
+#include "utils.h"
+
+#define KEEP_ORDER_VAR		"MINISHELL_KEEP_ORDER"
+
+bool keep_order_enabled(void)
+{
+	const char *value = getenv(KEEP_ORDER_VAR);
+
+	return value != NULL && *value != '\0' && strcmp(value, "0") != 0;
+}
+
+void job_output_open(struct job_output *j)
+{
+	j->out = memfd_create("job-stdout", MFD_CLOEXEC);
+	DIE(j->out < 0, "memfd_create");
+	j->err = memfd_create("job-stderr", MFD_CLOEXEC);
+	DIE(j->err < 0, "memfd_create");
+}
+
+void job_output_redirect(struct job_output *j)
+{
+	DIE(dup2(j->out, STDOUT_FILENO) < 0, "dup2");
+	DIE(dup2(j->err, STDERR_FILENO) < 0, "dup2");
+	close(j->out);
+	close(j->err);
+}
+
+/**
+ * Copy the whole memory file `from` to `to`.
+ */
+static void copy_file(int from, int to)
+{
+	struct stat st;
+
+	DIE(fstat(from, &st) < 0, "fstat");
+	copy_range(from, 0, st.st_size, to);
+}
+
+void job_output_flush(struct job_output *j)
+{
+	/* Anything the shell printed itself goes first. */
+	fflush(stdout);
+	fflush(stderr);
+
+	copy_file(j->out, STDOUT_FILENO);
+	copy_file(j->err, STDERR_FILENO);
+	close(j->out);
+	close(j->err);
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _KEEPORDER_H
+#define _KEEPORDER_H
+
+#include "../util/parser/parser.h"
+
+/**
+ * Ordered output of parallel commands (a & b & c).
+ *
+ * With MINISHELL_KEEP_ORDER set to a non-empty value other than 0, like
+ * GNU parallel's --keep-order, each side of & writes its stdout and
+ * stderr to memory files of its own (memfd_create()). The commands still
+ * run at the same time; as each one ends, in the order they were written,
+ * its output is copied to the real stdout and stderr, stdout first. The
+ * sides of nested & are ordered the same way, so a & b & c prints the
+ * output of a, then of b, then of c.
+ */
+
+struct job_output {
+	int out;
+	int err;
+};
+
+/**
+ * Tell if the output of parallel commands is kept in order.
+ */
+bool keep_order_enabled(void);
+
+/**
+ * Create the memory files a job will write to.
+ */
+void job_output_open(struct job_output *j);
+
+/**
+ * In the job's process, send stdout and stderr to its memory files.
+ */
+void job_output_redirect(struct job_output *j);
+
+/**
+ * Once the job ended, copy its output to stdout and stderr and close
+ * the memory files.
+ */
+void job_output_flush(struct job_output *j);
+
+#endif /* _KEEPORDER_H */
@@ -0,0 +1,347 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/ioctl.h>
+
+#include <termios.h>
+#include <unistd.h>
+
+#include "lineedit.h"
+#include "complete.h"
+#include "utils.h"
+
+#define HISTORY_SIZE		500
+#define MAX_LISTED		256
+
+#define KEY_CTRL(c)			((c) & 0x1f)
+#define KEY_ESC			27
+#define KEY_BACKSPACE		127
+
+/* Characters that end a word and put the next one in command position. */
+#define COMMAND_SEPARATORS	"|&;"
+#define WORD_SEPARATORS		" \t|&;<>"
+
+struct line {
+	char *buf;
+	size_t len;
+	size_t pos;
+	size_t size;
+	const char *prompt;
+};
+
+static char *history[HISTORY_SIZE];
+static int history_len;
+
+static void write_str(const char *s, size_t len)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = write(STDOUT_FILENO, s, len);
+		if (rc <= 0)
+			return;
+		s += rc;
+		len -= rc;
+	}
+}
+
+static void refresh(struct line *l)
+{
+	char seq[32];
+
+	write_str("\r", 1);
+	write_str(l->prompt, strlen(l->prompt));
+	write_str(l->buf, l->len);
+	write_str("\x1b[K", 3);
+
+	snprintf(seq, sizeof(seq), "\r\x1b[%zuC", strlen(l->prompt) + l->pos);
+	write_str(seq, strlen(seq));
+}
+
+static void insert(struct line *l, const char *s, size_t n)
+{
+	if (l->len + n + 1 > l->size) {
+		l->size = 2 * (l->len + n + 1);
+		l->buf = realloc(l->buf, l->size);
+		DIE(l->buf == NULL, "realloc");
+	}
+
+	memmove(l->buf + l->pos + n, l->buf + l->pos, l->len - l->pos);
+	memcpy(l->buf + l->pos, s, n);
+	l->len += n;
+	l->pos += n;
+	l->buf[l->len] = '\0';
+}
+
+static void erase(struct line *l, size_t from, size_t to)
+{
+	memmove(l->buf + from, l->buf + to, l->len - to);
+	l->len -= to - from;
+	l->pos = from;
+	l->buf[l->len] = '\0';
+}
+
+static void set_text(struct line *l, const char *s)
+{
+	l->len = 0;
+	l->pos = 0;
+	insert(l, s, strlen(s));
+}
+
+static void add_history(const char *line)
+{
+	if (*line == '\0')
+		return;
+	if (history_len > 0 && strcmp(history[history_len - 1], line) == 0)
+		return;
+
+	if (history_len == HISTORY_SIZE) {
+		free(history[0]);
+		memmove(history, history + 1, (HISTORY_SIZE - 1) * sizeof(*history));
+		history_len--;
+	}
+
+	history[history_len] = strdup(line);
+	DIE(history[history_len] == NULL, "strdup");
+	history_len++;
+}
+
+static void list_candidates(struct line *l, char **matches, size_t count,
+			    size_t total)
+{
+	struct winsize ws;
+	size_t width = 0, cols, i;
+	int len;
+
+	for (i = 0; i < count; i++)
+		if (strlen(matches[i]) > width)
+			width = strlen(matches[i]);
+	width += 2;
+
+	cols = 80;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		cols = ws.ws_col;
+	cols = cols / width ? cols / width : 1;
+
+	write_str("\r\n", 2);
+	for (i = 0; i < count; i++) {
+		write_str(matches[i], strlen(matches[i]));
+		if ((i + 1) % cols == 0 || i + 1 == count) {
+			write_str("\r\n", 2);
+		} else {
+			for (len = strlen(matches[i]); (size_t)len < width; len++)
+				write_str(" ", 1);
+		}
+	}
+
+	if (total > count) {
+		char more[64];
+
+		len = snprintf(more, sizeof(more), "... and %zu more\r\n", total - count);
+		write_str(more, len);
+	}
+
+	refresh(l);
+}
+
+/**
+ * Complete the word under the cursor: the first word of a command is
+ * looked up in PATH, the others in the file system.
+ */
+static void complete(struct line *l, bool listing)
+{
+	size_t start = l->pos, i, count, total, word_len;
+	char *word, *common, **matches;
+	bool command = true;
+
+	while (start > 0 && strchr(WORD_SEPARATORS, l->buf[start - 1]) == NULL)
+		start--;
+
+	for (i = start; i > 0; i--) {
+		if (l->buf[i - 1] == ' ' || l->buf[i - 1] == '\t')
+			continue;
+		command = strchr(COMMAND_SEPARATORS, l->buf[i - 1]) != NULL;
+		break;
+	}
+
+	word_len = l->pos - start;
+	word = strndup(l->buf + start, word_len);
+	DIE(word == NULL, "strndup");
+
+	total = complete_word(word, command, &common, &matches, MAX_LISTED);
+	free(word);
+	if (total == 0) {
+		write_str("\a", 1);
+		return;
+	}
+	count = total < MAX_LISTED ? total : MAX_LISTED;
+
+	if (total == 1) {
+		insert(l, matches[0] + word_len, strlen(matches[0]) - word_len);
+		if (l->buf[l->pos - 1] != '/')
+			insert(l, " ", 1);
+		refresh(l);
+	} else if (strlen(common) > word_len) {
+		insert(l, common + word_len, strlen(common) - word_len);
+		refresh(l);
+	} else if (listing) {
+		list_candidates(l, matches, count, total);
+	} else {
+		write_str("\a", 1);
+	}
+
+	free(common);
+	complete_free(matches, count);
+}
+
+char *lineedit_read(const char *prompt)
+{
+	struct termios orig, raw;
+	struct line l = { NULL, 0, 0, 0, prompt };
+	int history_pos = history_len;
+	bool last_tab = false;
+	char c, seq[3];
+
+	if (tcgetattr(STDIN_FILENO, &orig) == -1)
+		return NULL;
+
+	raw = orig;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+	set_text(&l, "");
+	refresh(&l);
+
+	while (read(STDIN_FILENO, &c, 1) == 1) {
+		bool tab = false;
+
+		switch (c) {
+		case '\r':
+		case '\n':
+			goto done;
+		case KEY_CTRL('d'):
+			if (l.len == 0) {
+				free(l.buf);
+				l.buf = NULL;
+				goto done;
+			}
+			if (l.pos < l.len)
+				erase(&l, l.pos, l.pos + 1);
+			break;
+		case KEY_CTRL('c'):
+			write_str("^C\r\n", 4);
+			set_text(&l, "");
+			break;
+		case '\t':
+			complete(&l, last_tab);
+			tab = true;
+			break;
+		case KEY_BACKSPACE:
+		case KEY_CTRL('h'):
+			if (l.pos > 0)
+				erase(&l, l.pos - 1, l.pos);
+			break;
+		case KEY_CTRL('a'):
+			l.pos = 0;
+			break;
+		case KEY_CTRL('e'):
+			l.pos = l.len;
+			break;
+		case KEY_CTRL('b'):
+			if (l.pos > 0)
+				l.pos--;
+			break;
+		case KEY_CTRL('f'):
+			if (l.pos < l.len)
+				l.pos++;
+			break;
+		case KEY_CTRL('k'):
+			erase(&l, l.pos, l.len);
+			break;
+		case KEY_CTRL('u'):
+			erase(&l, 0, l.pos);
+			break;
+		case KEY_CTRL('w'): {
+			size_t from = l.pos;
+
+			while (from > 0 && l.buf[from - 1] == ' ')
+				from--;
+			while (from > 0 && l.buf[from - 1] != ' ')
+				from--;
+			erase(&l, from, l.pos);
+			break;
+		}
+		case KEY_CTRL('l'):
+			write_str("\x1b[H\x1b[2J", 7);
+			break;
+		case KEY_CTRL('p'):
+		case KEY_CTRL('n'):
+			seq[0] = '[';
+			seq[1] = c == KEY_CTRL('p') ? 'A' : 'B';
+			goto arrow;
+		case KEY_ESC:
+			if (read(STDIN_FILENO, seq, 2) != 2)
+				break;
+arrow:
+			if (seq[0] != '[')
+				break;
+			switch (seq[1]) {
+			case 'A':
+				if (history_pos > 0)
+					set_text(&l, history[--history_pos]);
+				break;
+			case 'B':
+				if (history_pos < history_len)
+					history_pos++;
+				set_text(&l, history_pos < history_len ? history[history_pos] : "");
+				break;
+			case 'C':
+				if (l.pos < l.len)
+					l.pos++;
+				break;
+			case 'D':
+				if (l.pos > 0)
+					l.pos--;
+				break;
+			case 'H':
+				l.pos = 0;
+				break;
+			case 'F':
+				l.pos = l.len;
+				break;
+			case '3':
+				if (read(STDIN_FILENO, seq + 2, 1) == 1 && seq[2] == '~' &&
+				    l.pos < l.len)
+					erase(&l, l.pos, l.pos + 1);
+				break;
+			}
+			break;
+		default:
+			if ((unsigned char)c >= ' ')
+				insert(&l, &c, 1);
+			break;
+		}
+
+		last_tab = tab;
+		refresh(&l);
+	}
+
+	/* Read error or end of file. */
+	free(l.buf);
+	l.buf = NULL;
+
+done:
+	write_str("\r\n", 2);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig);
+
+	if (l.buf != NULL)
+		add_history(l.buf);
+
+	return l.buf;
+}
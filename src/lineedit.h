@@ -0,0 +1,13 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _LINEEDIT_H
+#define _LINEEDIT_H
+
+/**
+ * Read a line from the terminal with editing, history and Tab
+ * completion. Returns a malloc'ed line without the trailing newline, or
+ * NULL at end of input (Ctrl-D on an empty line).
+ */
+char *lineedit_read(const char *prompt);
+
+#endif /* _LINEEDIT_H */
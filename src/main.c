@@ -1,86 +1,132 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../util/parser/parser.h"
 #include "cmd.h"
 #include "utils.h"
+#include "pathexp.h"
+#include "lineedit.h"
+#include "scache.h"
+#include "server.h"
+#include "stats.h"
+#include "explain.h"
+#include "profile.h"
+#include "optimize.h"
 
 #define PROMPT             "> "
 #define CHUNK_SIZE         1024
 
 
+bool parse_errors_muted;
+
+/* Print the plan of each line instead of running it (--explain). */
+static bool explain;
+
 void parse_error(const char *str, const int where)
 {
+	if (parse_errors_muted)
+		return;
 	fprintf(stderr, "Parse error near %d: %s\n", where, str);
 }
 
+/* Script or standard input, read without stdio (see read_line). */
+struct input {
+	int fd;
+	size_t pos;
+	size_t len;
+	char buf[CHUNK_SIZE];
+};
+
 /**
  * Readline from mini-shell.
+ *
+ * The input is not read through stdio: a child exiting with unread data
+ * in a stdio buffer seeks the shared descriptor back, and the shell then
+ * reads the same lines again.
  */
-static char *read_line(void)
+static char *read_line(struct input *in)
 {
-	char *line = NULL;
-	int line_length = 0;
-
-	char chunk[CHUNK_SIZE];
-	int chunk_length;
-
-	char *rc;
-
-	int endline = 0;
-
-	while (!endline) {
-		rc = fgets(chunk, CHUNK_SIZE, stdin);
-		if (rc == NULL)
-			break;
-
-		chunk_length = strlen(chunk);
-		if (chunk[chunk_length - 1] == '\n') {
-			if (chunk_length > 1 && chunk[chunk_length - 2] == '\r')
-				/* Windows */
-				chunk[chunk_length - 2] = 0;
-			else
-				chunk[chunk_length - 1] = 0;
-			endline = 1;
+	char *line = NULL, *newline = NULL;
+	size_t line_length = 0, chunk_length;
+	ssize_t rc;
+
+	while (newline == NULL) {
+		if (in->pos == in->len) {
+			rc = read(in->fd, in->buf, sizeof(in->buf));
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc <= 0)
+				break;
+			in->pos = 0;
+			in->len = rc;
 		}
 
-		line = realloc(line, line_length + CHUNK_SIZE);
+		newline = memchr(in->buf + in->pos, '\n', in->len - in->pos);
+		if (newline != NULL)
+			chunk_length = newline - (in->buf + in->pos);
+		else
+			chunk_length = in->len - in->pos;
+
+		line = realloc(line, line_length + chunk_length + 1);
 		DIE(line == NULL, "Error allocating command line");
 
+		memcpy(line + line_length, in->buf + in->pos, chunk_length);
+		line_length += chunk_length;
 		line[line_length] = '\0';
-		strcat(line, chunk);
 
-		line_length += CHUNK_SIZE;
+		in->pos += chunk_length + (newline != NULL);
 	}
 
+	/* Windows */
+	if (line_length > 0 && line[line_length - 1] == '\r')
+		line[line_length - 1] = '\0';
+
 	return line;
 }
 
-static void start_shell(void)
+static void start_shell(int fd, bool prompt)
 {
+	struct input in = { .fd = fd };
+	unsigned long number = 0;
 	char *line;
 	command_t *root;
 
 	int ret;
+	bool interactive = prompt && isatty(fd) && isatty(STDOUT_FILENO);
 
 	for (;;) {
-		printf(PROMPT);
-		fflush(stdout);
 		ret = 0;
 
 		root = NULL;
-		line = read_line();
+		if (interactive) {
+			line = lineedit_read(PROMPT);
+		} else {
+			if (prompt) {
+				printf(PROMPT);
+				fflush(stdout);
+			}
+			line = read_line(&in);
+		}
 		if (line == NULL)
 			return;
-		parse_line(line, &root);
+		profile_line(++number);
+		stats_parse_line(line, &root);
+		root = optimize_command(root);
 
-		if (root != NULL)
+		if (root != NULL && explain)
+			explain_command(root);
+		else if (root != NULL)
 			ret = parse_command(root, 0, NULL);
 
 		free_parse_memory();
+		pathexp_flush_cache();
 		free(line);
 
 		if (ret == SHELL_EXIT)
@@ -88,9 +134,121 @@ static void start_shell(void)
 	}
 }
 
-int main(void)
+/**
+ * Run a script from its compiled form.
+ */
+static void run_compiled(struct script *script)
 {
-	start_shell();
+	command_t *root;
+	const char *text;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < scache_lines(script); i++) {
+		root = NULL;
+		ret = 0;
+		profile_line(i + 1);
+
+		switch (scache_line(script, i, &root, &text)) {
+		case SCRIPT_LINE_COMMAND:
+			root = optimize_command(root);
+			if (explain)
+				explain_command(root);
+			else
+				ret = parse_command(root, 0, NULL);
+			break;
+		case SCRIPT_LINE_ERROR:
+			/* Parse it again, this time reporting the error. */
+			parse_line(text, &root);
+			free_parse_memory();
+			break;
+		}
+
+		pathexp_flush_cache();
+
+		if (ret == SHELL_EXIT)
+			break;
+	}
+}
+
+static int run_script(const char *path)
+{
+	struct script *script;
+	int fd;
+
+	script = scache_open(path);
+	if (script != NULL) {
+		run_compiled(script);
+		scache_close(script);
+		return EXIT_SUCCESS;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "%s: ", path);
+		perror("open");
+		return EXIT_FAILURE;
+	}
+
+	start_shell(fd, false);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [--explain] [--server SOCKET] [SCRIPT]\n", name);
+	fprintf(stderr, "       %s --client SOCKET LINE\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "explain", no_argument, NULL, 'e' },
+		{ "server", required_argument, NULL, 's' },
+		{ "client", required_argument, NULL, 'c' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *server = NULL, *client = NULL;
+	int opt, status;
+
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (opt) {
+		case 'e':
+			explain = true;
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 'c':
+			client = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (client != NULL) {
+		if (optind != argc - 1) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		status = server_send(client, argv[optind]);
+		return status < 0 ? EXIT_FAILURE : status;
+	}
+
+	stats_init();
+	profile_init();
+
+	if (server != NULL)
+		return server_run(server) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (optind < argc)
+		return run_script(argv[optind]);
+
+	start_shell(STDIN_FILENO, true);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,667 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "memo.h"
+#include "sha256.h"
+#include "stats.h"
+#include "utils.h"
+
+#define MEMO_DIR_VAR		"MINISHELL_MEMO_DIR"
+#define MEMO_SIZE_VAR		"MINISHELL_MEMO_SIZE"
+#define MEMO_SUBDIR		"minishell/memo"
+#define MEMO_DEFAULT_SIZE	(64ULL << 20)
+
+#define MEMO_MAGIC		"MSMEMO1"
+#define NAME_LEN		(2 * SHA256_LEN)	/* hex digits of a key */
+
+/* Start of an entry, followed by the stdout then the stderr bytes. */
+struct entry_header {
+	char magic[8];
+	unsigned char key[SHA256_LEN];	/* checked against the name */
+	int64_t status;
+	uint64_t out_len;
+	uint64_t err_len;
+};
+
+/* Bytes of a file copied out, stdout or stderr of an entry. */
+struct range {
+	int fd;
+	off_t off;
+	off_t len;
+};
+
+struct cache_entry {
+	char name[NAME_LEN + 1];
+	struct timespec used;
+	off_t size;
+};
+
+/**
+ * The cache directory, allocated; NULL if there is no place for it.
+ */
+static char *memo_dir(void)
+{
+	const char *value = getenv(MEMO_DIR_VAR);
+	const char *format = "%s/" MEMO_SUBDIR;
+	char *dir;
+
+	if (value != NULL && *value != '\0') {
+		dir = strdup(value);
+		DIE(dir == NULL, "strdup");
+		return dir;
+	}
+
+	value = getenv("XDG_CACHE_HOME");
+	if (value == NULL || *value == '\0') {
+		value = getenv("HOME");
+		format = "%s/.cache/" MEMO_SUBDIR;
+	}
+	if (value == NULL || *value == '\0')
+		return NULL;
+
+	DIE(asprintf(&dir, format, value) < 0, "asprintf");
+	return dir;
+}
+
+/**
+ * Create the directory and its parents, like mkdir -p.
+ */
+static bool make_dir(const char *dir)
+{
+	char *path = strdup(dir);
+	struct stat st;
+	char *p;
+
+	DIE(path == NULL, "strdup");
+
+	for (p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+	mkdir(path, 0755);
+	free(path);
+
+	return stat(dir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * Largest size of the cache, in bytes.
+ */
+static uint64_t memo_limit(void)
+{
+	const char *value = getenv(MEMO_SIZE_VAR);
+	uint64_t size = value != NULL ? parse_size(value) : 0;
+
+	return size != 0 ? size : MEMO_DEFAULT_SIZE;
+}
+
+static void entry_name(const struct memo_key *key, char *name)
+{
+	int i;
+
+	for (i = 0; i < SHA256_LEN; i++)
+		snprintf(name + 2 * i, 3, "%02x", key->digest[i]);
+}
+
+static bool is_entry_name(const char *name)
+{
+	return strlen(name) == NAME_LEN &&
+	       strspn(name, "0123456789abcdef") == NAME_LEN;
+}
+
+static void key_add_bytes(struct sha256 *key, const void *buf, size_t len)
+{
+	sha256_update(key, buf, len);
+}
+
+/**
+ * Add a string with its length, so that consecutive strings cannot be
+ * split differently for the same key.
+ */
+static void key_add_string(struct sha256 *key, const char *str)
+{
+	uint64_t len = strlen(str);
+
+	key_add_bytes(key, &len, sizeof(len));
+	key_add_bytes(key, str, len);
+}
+
+/**
+ * Add the contents of `fd` from `off` to the end; with `copy` >= 0, what
+ * is read is also written there.
+ */
+static void key_add_contents(struct sha256 *key, int fd, off_t off, int copy)
+{
+	static char buf[COPY_BLOCK];
+	ssize_t n;
+
+	for (;;) {
+		n = off >= 0 ? pread(fd, buf, sizeof(buf), off) :
+			       read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		if (off >= 0)
+			off += n;
+		key_add_bytes(key, buf, n);
+		if (copy >= 0)
+			DIE(write(copy, buf, n) != n, "write");
+	}
+}
+
+/**
+ * Add a file by path, size, modification time and, for regular files,
+ * contents. A missing file makes a key of its own.
+ */
+static void key_add_file(struct sha256 *key, const char *path)
+{
+	uint64_t meta[3] = { 0 };
+	struct stat st;
+	int fd;
+
+	key_add_string(key, path);
+
+	if (stat(path, &st) == 0) {
+		meta[0] = st.st_size;
+		meta[1] = st.st_mtim.tv_sec;
+		meta[2] = st.st_mtim.tv_nsec;
+	} else {
+		meta[0] = UINT64_MAX;
+	}
+	key_add_bytes(key, meta, sizeof(meta));
+
+	if (meta[0] == UINT64_MAX || !S_ISREG(st.st_mode))
+		return;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	key_add_contents(key, fd, 0, -1);
+	close(fd);
+}
+
+static bool is_dev_null(const struct stat *st)
+{
+	struct stat null;
+
+	return S_ISCHR(st->st_mode) && stat("/dev/null", &null) == 0 &&
+	       st->st_rdev == null.st_rdev;
+}
+
+/**
+ * Add the stdin the command inherits from the shell. A regular file is
+ * added from its offset on. A pipe or socket is read whole into a memory
+ * file, which is then the stdin of the shell until memo_key_release().
+ * Anything else, such as a terminal, cannot be known in advance.
+ */
+static bool key_add_stdin(struct sha256 *key, struct memo_key *digest)
+{
+	struct stat st;
+	int fd;
+
+	if (fstat(STDIN_FILENO, &st) < 0 || is_dev_null(&st)) {
+		key_add_string(key, "<&-");
+		return true;
+	}
+
+	key_add_string(key, "<&0");
+
+	if (S_ISREG(st.st_mode)) {
+		key_add_contents(key, STDIN_FILENO, lseek(STDIN_FILENO, 0, SEEK_CUR),
+				 -1);
+		return true;
+	}
+
+	if (!S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode))
+		return false;
+
+	fd = memfd_create("memo-stdin", MFD_CLOEXEC);
+	DIE(fd < 0, "memfd_create");
+	key_add_contents(key, STDIN_FILENO, -1, fd);
+	DIE(lseek(fd, 0, SEEK_SET) < 0, "lseek");
+
+	digest->saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	DIE(digest->saved_stdin < 0, "fcntl");
+	DIE(dup2(fd, STDIN_FILENO) < 0, "dup2");
+	close(fd);
+
+	return true;
+}
+
+word_t *memo_command(word_t *params)
+{
+	word_t *w = params;
+
+	while (w != NULL && (is_literal(w, "-i") || is_literal(w, "-e"))) {
+		if (w->next_word == NULL)
+			return NULL;
+		w = w->next_word->next_word;
+	}
+
+	return w;
+}
+
+bool memo_key(word_t *params, simple_command_t *inner, char **argv, int argc,
+	      struct memo_key *digest)
+{
+	uint64_t count = argc;
+	struct sha256 sha, *key = &sha;
+	bool known = true;
+	const char *value;
+	char *cwd, *arg;
+	word_t *w;
+	int i;
+
+	sha256_init(key);
+	digest->saved_stdin = -1;
+
+	key_add_bytes(key, &count, sizeof(count));
+	for (i = 0; i < argc; i++)
+		key_add_string(key, argv[i]);
+
+	cwd = getcwd(NULL, 0);
+	DIE(cwd == NULL, "getcwd");
+	key_add_string(key, cwd);
+	free(cwd);
+
+	for (w = params; w != inner->verb; w = w->next_word->next_word) {
+		arg = get_word(w->next_word);
+		if (is_literal(w, "-i")) {
+			key_add_string(key, "-i");
+			key_add_file(key, arg);
+		} else {
+			value = getenv(arg);
+			key_add_string(key, value != NULL ? "-e" : "-e unset");
+			key_add_string(key, arg);
+			key_add_string(key, value != NULL ? value : "");
+		}
+		free(arg);
+	}
+
+	/* Opened as written, like spawn_simple() does. */
+	if (inner->in != NULL) {
+		key_add_string(key, "<");
+		key_add_file(key, inner->in->string);
+	} else {
+		known = key_add_stdin(key, digest);
+	}
+
+	sha256_final(key, digest->digest);
+	return known;
+}
+
+void memo_key_release(struct memo_key *key)
+{
+	if (key->saved_stdin < 0)
+		return;
+
+	DIE(dup2(key->saved_stdin, STDIN_FILENO) < 0, "dup2");
+	close(key->saved_stdin);
+	key->saved_stdin = -1;
+}
+
+static void copy_out_range(const struct range *r, int to)
+{
+	copy_range(r->fd, r->off, r->off + r->len, to);
+}
+
+static int open_target(word_t *w, bool append)
+{
+	char *path = get_word(w);
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC |
+		  (append ? O_APPEND : O_TRUNC), 0644);
+	if (fd < 0)
+		perror(path);
+	free(path);
+
+	return fd;
+}
+
+/**
+ * Copy `r` to every target of a redirection, or to `fd` if there is
+ * none; `also` goes after it, for &>.
+ */
+static bool copy_out(const struct range *r, const struct range *also,
+		     word_t *targets, bool append, int fd)
+{
+	bool ok = true;
+	int to;
+
+	if (targets == NULL) {
+		copy_out_range(r, fd);
+		if (also != NULL)
+			copy_out_range(also, fd);
+		return true;
+	}
+
+	for (; targets != NULL; targets = targets->next_word) {
+		to = open_target(targets, append);
+		if (to < 0) {
+			ok = false;
+			continue;
+		}
+		copy_out_range(r, to);
+		if (also != NULL)
+			copy_out_range(also, to);
+		close(to);
+	}
+
+	return ok;
+}
+
+/**
+ * Tell if stdout and stderr go to the same file, as run_simple() does.
+ */
+static bool same_target(simple_command_t *s)
+{
+	char *out, *err;
+	bool same;
+
+	if (s->out == NULL || s->err == NULL)
+		return false;
+	if (s->out == s->err)
+		return true;
+
+	out = get_word(s->out);
+	err = get_word(s->err);
+	same = strcmp(out, err) == 0;
+	free(out);
+	free(err);
+
+	return same;
+}
+
+/**
+ * Write the output of a command to its redirections or to the shell's
+ * stdout and stderr.
+ */
+static bool replay(simple_command_t *s, const struct range *out,
+		   const struct range *err)
+{
+	bool ok;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if (same_target(s))
+		return copy_out(out, err, s->out, s->io_flags & IO_OUT_APPEND,
+				STDOUT_FILENO);
+
+	ok = copy_out(out, NULL, s->out, s->io_flags & IO_OUT_APPEND,
+		      STDOUT_FILENO);
+	return copy_out(err, NULL, s->err, s->io_flags & IO_ERR_APPEND,
+			STDERR_FILENO) && ok;
+}
+
+int memo_replay(const struct memo_key *key, simple_command_t *s)
+{
+	struct entry_header header;
+	struct range out, err;
+	char name[NAME_LEN + 1];
+	struct stat st;
+	char *dir;
+	int fd;
+
+	dir = memo_dir();
+	if (dir == NULL)
+		return -1;
+
+	entry_name(key, name);
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dir);
+	if (fd < 0)
+		return -1;
+	out.fd = openat(fd, name, O_RDONLY | O_CLOEXEC);
+	close(fd);
+	if (out.fd < 0)
+		return -1;
+
+	/* A partial or foreign file is run again and replaced. */
+	if (pread(out.fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, MEMO_MAGIC, sizeof(header.magic)) != 0 ||
+	    memcmp(header.key, key->digest, sizeof(header.key)) != 0 ||
+	    fstat(out.fd, &st) < 0 ||
+	    (uint64_t)st.st_size != sizeof(header) + header.out_len + header.err_len) {
+		close(out.fd);
+		return -1;
+	}
+
+	/* The modification time tells the least recently used entries. */
+	futimens(out.fd, NULL);
+
+	out.off = sizeof(header);
+	out.len = header.out_len;
+	err.fd = out.fd;
+	err.off = out.off + out.len;
+	err.len = header.err_len;
+
+	stats_add(STATS_MEMO_HITS, 1);
+	if (!replay(s, &out, &err))
+		header.status = 1;
+	close(out.fd);
+
+	return header.status;
+}
+
+void memo_capture_start(struct memo_capture *c)
+{
+	fflush(stdout);
+	fflush(stderr);
+
+	c->out = memfd_create("memo-stdout", MFD_CLOEXEC);
+	DIE(c->out < 0, "memfd_create");
+	c->err = memfd_create("memo-stderr", MFD_CLOEXEC);
+	DIE(c->err < 0, "memfd_create");
+
+	c->saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	DIE(c->saved_out < 0, "fcntl");
+	c->saved_err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+	DIE(c->saved_err < 0, "fcntl");
+
+	DIE(dup2(c->out, STDOUT_FILENO) < 0, "dup2");
+	DIE(dup2(c->err, STDERR_FILENO) < 0, "dup2");
+}
+
+static int compare_used(const void *a, const void *b)
+{
+	const struct cache_entry *x = a, *y = b;
+
+	if (x->used.tv_sec != y->used.tv_sec)
+		return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+	if (x->used.tv_nsec != y->used.tv_nsec)
+		return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+/**
+ * List the entries of the cache directory open as `dirfd`. Returns their
+ * number; the array is allocated.
+ */
+static size_t scan_entries(int dirfd, struct cache_entry **entries,
+			   uint64_t *total)
+{
+	size_t n = 0, size = 0;
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	*entries = NULL;
+	*total = 0;
+
+	dir = fdopendir(dup(dirfd));
+	if (dir == NULL)
+		return 0;
+
+	while ((d = readdir(dir)) != NULL) {
+		if (!is_entry_name(d->d_name) ||
+		    fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+		    !S_ISREG(st.st_mode))
+			continue;
+
+		if (n == size) {
+			size = size ? 2 * size : 64;
+			*entries = realloc(*entries, size * sizeof(**entries));
+			DIE(*entries == NULL, "realloc");
+		}
+		strcpy((*entries)[n].name, d->d_name);
+		(*entries)[n].used = st.st_mtim;
+		(*entries)[n].size = st.st_size;
+		*total += st.st_size;
+		n++;
+	}
+	closedir(dir);
+
+	return n;
+}
+
+/**
+ * Remove the least recently used entries until the cache fits its size.
+ */
+static void evict(int dirfd)
+{
+	struct cache_entry *entries;
+	uint64_t total, limit = memo_limit();
+	size_t n, i;
+
+	n = scan_entries(dirfd, &entries, &total);
+	if (total > limit) {
+		qsort(entries, n, sizeof(*entries), compare_used);
+		for (i = 0; i < n && total > limit; i++) {
+			if (unlinkat(dirfd, entries[i].name, 0) < 0)
+				continue;
+			total -= entries[i].size;
+			stats_add(STATS_MEMO_EVICTIONS, 1);
+		}
+	}
+	free(entries);
+}
+
+/**
+ * Write an entry under a temporary name, then rename it: concurrent
+ * shells see either no entry or a whole one.
+ */
+static void store(const struct memo_key *key, int status,
+		  const struct range *out, const struct range *err)
+{
+	struct entry_header header = { MEMO_MAGIC, { 0 }, status, out->len,
+				       err->len };
+	char name[NAME_LEN + 1], tmp[NAME_LEN + 32];
+	int dirfd, fd;
+	char *dir;
+	bool ok;
+
+	dir = memo_dir();
+	if (dir == NULL || !make_dir(dir)) {
+		fprintf(stderr, "memo: no cache directory, set %s\n", MEMO_DIR_VAR);
+		free(dir);
+		return;
+	}
+	dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dir);
+	if (dirfd < 0)
+		return;
+
+	memcpy(header.key, key->digest, sizeof(header.key));
+	entry_name(key, name);
+	snprintf(tmp, sizeof(tmp), "%s.%d", name, getpid());
+
+	fd = openat(dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		close(dirfd);
+		return;
+	}
+
+	ok = write(fd, &header, sizeof(header)) == sizeof(header);
+	copy_out_range(out, fd);
+	copy_out_range(err, fd);
+	ok = ok && lseek(fd, 0, SEEK_END) ==
+		   (off_t)(sizeof(header) + out->len + err->len);
+	close(fd);
+
+	if (!ok || renameat(dirfd, tmp, dirfd, name) < 0)
+		unlinkat(dirfd, tmp, 0);
+	else
+		evict(dirfd);
+
+	close(dirfd);
+}
+
+int memo_capture_finish(struct memo_capture *c, const struct memo_key *key,
+			int status, simple_command_t *s)
+{
+	struct range out = { c->out, 0, 0 }, err = { c->err, 0, 0 };
+
+	fflush(stdout);
+	fflush(stderr);
+
+	DIE(dup2(c->saved_out, STDOUT_FILENO) < 0, "dup2");
+	DIE(dup2(c->saved_err, STDERR_FILENO) < 0, "dup2");
+	close(c->saved_out);
+	close(c->saved_err);
+
+	out.len = lseek(c->out, 0, SEEK_END);
+	err.len = lseek(c->err, 0, SEEK_END);
+
+	stats_add(STATS_MEMO_MISSES, 1);
+	store(key, status, &out, &err);
+	if (!replay(s, &out, &err))
+		status = 1;
+
+	close(c->out);
+	close(c->err);
+
+	return status;
+}
+
+void memo_print_stats(FILE *file)
+{
+	struct cache_entry *entries;
+	uint64_t total = 0;
+	size_t n = 0;
+	char *dir;
+	int dirfd;
+
+	fprintf(file, "%-20s%" PRIu64 "\n", "hits", stats_get(STATS_MEMO_HITS));
+	fprintf(file, "%-20s%" PRIu64 "\n", "misses",
+		stats_get(STATS_MEMO_MISSES));
+	fprintf(file, "%-20s%" PRIu64 "\n", "evictions",
+		stats_get(STATS_MEMO_EVICTIONS));
+
+	dir = memo_dir();
+	if (dir == NULL) {
+		fprintf(file, "%-20s%s\n", "directory", "none");
+		return;
+	}
+
+	dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd >= 0) {
+		n = scan_entries(dirfd, &entries, &total);
+		free(entries);
+		close(dirfd);
+	}
+
+	fprintf(file, "%-20s%s\n", "directory", dir);
+	fprintf(file, "%-20s%zu\n", "entries", n);
+	fprintf(file, "%-20s%" PRIu64 " of %" PRIu64 " bytes\n", "size", total,
+		memo_limit());
+	free(dir);
+}
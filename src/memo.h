@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _MEMO_H
+#define _MEMO_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../util/parser/parser.h"
+#include "sha256.h"
+
+/**
+ * Result cache of the memo internal command.
+ *
+ * memo [-i PATH]... [-e NAME]... COMMAND [ARG]... runs an external
+ * command declared pure: its output and exit status only depend on its
+ * arguments, the current directory, the environment variables named with
+ * -e, its input and the files named with -i. The SHA-256 of these is
+ * the key of the cache, files by path, size, modification time and
+ * contents. Each entry holds its key, checked on a hit.
+ *
+ * Without <, the input is the stdin of the shell: a pipe is read whole
+ * before the command runs, to be part of the key, and a terminal makes
+ * the command run without the cache.
+ *
+ * When an entry is found, the stdout, stderr and exit status it holds are
+ * replayed to the redirections of the command instead of running it.
+ * Otherwise, the command runs with its output captured, which is then
+ * stored and copied out; stdout comes before stderr, so a command writing
+ * both to the same file (&>) does not get them interleaved as they were.
+ *
+ * Entries are files named by their key in MINISHELL_MEMO_DIR, by default
+ * $XDG_CACHE_HOME/minishell/memo or ~/.cache/minishell/memo. When they
+ * take more than MINISHELL_MEMO_SIZE bytes (K, M and G suffixes allowed,
+ * 64M by default), the least recently used ones are removed.
+ *
+ * memo --stats prints the hits, misses and evictions of the session and
+ * the size of the cache.
+ */
+
+/* Exit status when memo itself fails, like timeout. */
+#define MEMO_USAGE		125
+
+struct memo_key {
+	unsigned char digest[SHA256_LEN];
+	int saved_stdin;	/* of the shell, if replaced by its contents */
+};
+
+struct memo_capture {
+	int out;
+	int err;
+	int saved_out;
+	int saved_err;
+};
+
+/**
+ * Skip the options of memo, starting at its first parameter. Returns the
+ * word of the command, NULL if there is none.
+ */
+word_t *memo_command(word_t *params);
+
+/**
+ * Compute the key of the command `inner`, run by memo with the options
+ * from `params` up to the verb of `inner`. `argv` holds its words, already
+ * expanded: the command must run with exactly these. Returns false if
+ * the input of the command cannot be part of the key: it must not be
+ * cached then. Call memo_key_release() once the command ran.
+ */
+bool memo_key(word_t *params, simple_command_t *inner, char **argv, int argc,
+	      struct memo_key *key);
+
+/**
+ * Give the shell its stdin back, if memo_key() read it.
+ */
+void memo_key_release(struct memo_key *key);
+
+/**
+ * If `key` has an entry, replay it to the redirections of `s`. Returns
+ * the exit status stored, -1 if there is no entry.
+ */
+int memo_replay(const struct memo_key *key, simple_command_t *s);
+
+/**
+ * Start capturing stdout and stderr, in the shell process; the commands
+ * it runs until memo_capture_finish() inherit them.
+ */
+void memo_capture_start(struct memo_capture *c);
+
+/**
+ * Stop capturing, store the output with `status` under `key`, evicting
+ * old entries, and copy it to the redirections of `s`. Returns `status`.
+ */
+int memo_capture_finish(struct memo_capture *c, const struct memo_key *key,
+			int status, simple_command_t *s);
+
+/**
+ * Print the cache counters of the session and the size of the cache.
+ */
+void memo_print_stats(FILE *file);
+
+#endif /* _MEMO_H */
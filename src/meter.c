@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "meter.h"
+#include "stats.h"
+#include "timeout.h"
+#include "utils.h"
+
+#define METER_CHUNK		(64 * 1024)
+
+#define NS_PER_SEC		1000000000ULL
+#define NS_PER_MS		1000000ULL
+
+struct relay {
+	const char *writer;
+	const char *reader;
+	uint64_t start;
+	uint64_t bytes;
+	uint64_t wait_writer;	/* for data from the writer */
+	uint64_t wait_reader;	/* for room in the reader's pipe */
+	uint64_t interval;	/* between the reports while running, 0 if none */
+	uint64_t next;		/* time of the next one */
+};
+
+static void report(const struct relay *r, bool done)
+{
+	double seconds = (double)(stats_now() - r->start) / NS_PER_SEC;
+	double rate = seconds > 0 ? r->bytes / seconds / 1e6 : 0;
+	const char *bottleneck = r->wait_reader > r->wait_writer ?
+				 r->reader : r->writer;
+
+	/* One call, so that the lines of several relays do not mix. */
+	fprintf(stderr, "pipe %s -> %s: %llu bytes in %.3f s, %.2f MB/s, waited %.3f s for %s, %.3f s for %s, %s%s\n",
+		r->writer, r->reader, (unsigned long long)r->bytes, seconds, rate,
+		(double)r->wait_writer / NS_PER_SEC, r->writer,
+		(double)r->wait_reader / NS_PER_SEC, r->reader,
+		done ? "bottleneck " : "so far", done ? bottleneck : "");
+}
+
+/**
+ * Report if the interval is over.
+ */
+static void tick(struct relay *r)
+{
+	uint64_t now;
+
+	if (r->interval == 0)
+		return;
+
+	now = stats_now();
+	if (now < r->next)
+		return;
+
+	report(r, false);
+	r->next = now + r->interval;
+}
+
+/**
+ * Wait for `fd` to be ready, adding the time to `waited`, or for the
+ * next report.
+ */
+static void wait_for(struct relay *r, int fd, short events, uint64_t *waited)
+{
+	struct pollfd p = { .fd = fd, .events = events };
+	uint64_t start = stats_now();
+	int timeout = -1;
+
+	if (r->interval != 0)
+		timeout = r->next > start ?
+			  (int)((r->next - start + NS_PER_MS - 1) / NS_PER_MS) : 0;
+
+	poll(&p, 1, timeout);
+	*waited += stats_now() - start;
+}
+
+static void run_relay(int in, int out, struct relay *r)
+{
+	struct pollfd p = { .fd = in, .events = POLLIN };
+	ssize_t n;
+
+	/* A reader gone shows as EPIPE; the writer then gets it too. */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		tick(r);
+
+		n = splice(in, NULL, out, NULL, METER_CHUNK,
+			   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			r->bytes += n;
+			continue;
+		}
+		if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			break;
+		if (errno == EINTR)
+			continue;
+
+		/* Either there is nothing to read or no room to write. */
+		if (poll(&p, 1, 0) == 1 && (p.revents & POLLIN))
+			wait_for(r, out, POLLOUT, &r->wait_reader);
+		else
+			wait_for(r, in, POLLIN, &r->wait_writer);
+	}
+
+	report(r, true);
+}
+
+bool meter_enabled(void)
+{
+	const char *value = getenv(METER_VAR);
+
+	return value != NULL && *value != '\0' && strcmp(value, "0") != 0;
+}
+
+void meter_start(int fds[2], const char *writer, const char *reader,
+		 struct meter *m)
+{
+	struct relay r = { writer, reader, 0, 0, 0, 0, 0, 0 };
+	const char *value = getenv(METER_INTERVAL_VAR);
+	struct timespec interval;
+	int from_writer[2], to_reader[2];
+
+	DIE(pipe(from_writer) < 0, "pipe");
+	DIE(pipe(to_reader) < 0, "pipe");
+
+	m->pid = stats_fork();
+	DIE(m->pid < 0, "fork");
+	if (m->pid == 0) {
+		close(from_writer[PIPE_WRITE]);
+		close(to_reader[PIPE_READ]);
+
+		if (value != NULL && timeout_parse(value, &interval))
+			r.interval = interval.tv_sec * NS_PER_SEC + interval.tv_nsec;
+		r.start = stats_now();
+		r.next = r.start + r.interval;
+
+		run_relay(from_writer[PIPE_READ], to_reader[PIPE_WRITE], &r);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(from_writer[PIPE_READ]);
+	close(to_reader[PIPE_WRITE]);
+	fds[PIPE_READ] = to_reader[PIPE_READ];
+	fds[PIPE_WRITE] = from_writer[PIPE_WRITE];
+}
+
+void meter_finish(struct meter *m)
+{
+	if (m->pid < 0)
+		return;
+
+	stats_waitpid(m->pid, NULL, 0);
+	m->pid = -1;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _METER_H
+#define _METER_H
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Throughput meter of the pipes between pipeline stages.
+ *
+ * With MINISHELL_PIPE_METER set (and not 0), every kernel pipe of a
+ * pipeline is made of two pipes with a relay process in between, which
+ * moves the data with splice(2), so it never goes through user space,
+ * and counts the bytes and the time it waits for each side: waiting for
+ * the writer means the writer is the slower one, waiting for room in the
+ * reader's pipe means the reader back-pressures the writer. When the
+ * writer ends, a line goes to stderr:
+ *
+ *   pipe seq -> gzip: 48894 bytes in 0.012 s, 4.07 MB/s, waited 0.001 s
+ *   for seq, 0.010 s for gzip, bottleneck gzip
+ *
+ * (on a single line). With MINISHELL_PIPE_METER_INTERVAL set to a
+ * duration, as for timeout, the relays also report while they run,
+ * every interval, with "so far" instead of the bottleneck.
+ */
+
+#define METER_VAR		"MINISHELL_PIPE_METER"
+#define METER_INTERVAL_VAR	"MINISHELL_PIPE_METER_INTERVAL"
+
+struct meter {
+	pid_t pid;	/* the relay process, -1 if none */
+};
+
+/**
+ * Tell if the pipes of pipelines are metered.
+ */
+bool meter_enabled(void);
+
+/**
+ * Make a pipe in `fds` like pipe(), from the stage named `writer` to the
+ * one named `reader`, with a relay in between.
+ */
+void meter_start(int fds[2], const char *writer, const char *reader,
+		 struct meter *m);
+
+/**
+ * Wait for the relay to report, once the shell closed both ends.
+ */
+void meter_finish(struct meter *m);
+
+#endif /* _METER_H */
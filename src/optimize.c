@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "optimize.h"
+#include "cmd.h"
+#include "utils.h"
+
+#define OPTIMIZE_VAR		"MINISHELL_OPTIMIZE"
+#define OPTIMIZE_DUMP		"dump"
+
+static const char * const separators[OP_DUMMY] = {
+	[OP_SEQUENTIAL] = "; ",
+	[OP_PARALLEL] = " & ",
+	[OP_CONDITIONAL_ZERO] = " && ",
+	[OP_CONDITIONAL_NZERO] = " || ",
+	[OP_PIPE] = " | ",
+};
+
+/**
+ * Tell if a node is the command `verb` alone: no parameters and no
+ * redirections.
+ */
+static bool is_bare(command_t *c, const char *verb)
+{
+	simple_command_t *s = c->scmd;
+
+	return c->op == OP_NONE && is_literal(s->verb, verb) &&
+	       s->params == NULL && s->in == NULL && s->out == NULL &&
+	       s->err == NULL;
+}
+
+/**
+ * Tell if a word names a file the same way as an input redirection: a
+ * single literal part, not an option, without wildcards to expand.
+ */
+static bool is_file_name(word_t *w)
+{
+	return w->next_word == NULL && w->next_part == NULL && !w->expand &&
+	       !w->arith && w->string[0] != '-' &&
+	       (w->quoted || strpbrk(w->string, "*?[") == NULL);
+}
+
+/**
+ * Tell if a node only copies a file or its stdin to its stdout (cat FILE,
+ * cat < FILE or cat); `file` is set to the input, NULL for stdin.
+ */
+static bool is_cat_input(command_t *c, word_t **file)
+{
+	simple_command_t *s = c->scmd;
+
+	if (c->op != OP_NONE || !is_literal(s->verb, "cat") ||
+	    s->out != NULL || s->err != NULL)
+		return false;
+
+	if (s->params == NULL) {
+		*file = s->in;
+		return true;
+	}
+
+	*file = s->params;
+	return s->in == NULL && is_file_name(s->params);
+}
+
+/**
+ * Tell if a node only copies its stdin to its stdout or to files (cat or
+ * cat > FILE).
+ */
+static bool is_cat_output(command_t *c)
+{
+	simple_command_t *s = c->scmd;
+
+	return c->op == OP_NONE && is_literal(s->verb, "cat") &&
+	       s->params == NULL && s->in == NULL && s->err == NULL;
+}
+
+/**
+ * The simple command reading the input of a pipeline, or writing its
+ * output (`last`). NULL if it cannot take over a redirection.
+ */
+static simple_command_t *pipeline_end(command_t *c, bool last)
+{
+	while (c->op == OP_PIPE)
+		c = last ? c->cmd2 : c->cmd1;
+
+	if (c->op != OP_NONE || is_assignment(c->scmd->verb))
+		return NULL;
+
+	return c->scmd;
+}
+
+/**
+ * Tell if `c` still runs apart from the shell once it is no longer a
+ * stage of a pipe: an external command, or a pipeline that is not made
+ * of internal commands only (see ring.h). Internal commands, assignments
+ * and loops would otherwise run in the shell itself.
+ */
+static bool runs_apart(command_t *c)
+{
+	command_t **stages;
+	bool apart = false;
+	size_t n, i;
+
+	if (c->op == OP_NONE)
+		return !is_builtin(c->scmd->verb) && !is_assignment(c->scmd->verb);
+	if (c->op != OP_PIPE)
+		return false;
+
+	n = pipeline_stages(c, NULL, 0);
+	stages = malloc(n * sizeof(*stages));
+	DIE(stages == NULL, "malloc");
+	pipeline_stages(c, stages, 0);
+
+	for (i = 0; i < n && !apart; i++)
+		apart = stages[i]->op != OP_NONE ||
+			!is_ring_builtin(stages[i]->scmd);
+	free(stages);
+
+	return apart;
+}
+
+/**
+ * Tell if the input file of a cat can be read now; if not, cat stays to
+ * report it, and the rest of the pipeline runs without input as before.
+ */
+static bool is_readable(word_t *file)
+{
+	return access(file->string, R_OK) == 0;
+}
+
+/**
+ * Put `by`, a child of `c`, in the place of `c` in the tree.
+ */
+static command_t *replace(command_t *c, command_t *by)
+{
+	by->up = c->up;
+	if (c->up != NULL && c->up->cmd1 == c)
+		c->up->cmd1 = by;
+	else if (c->up != NULL && c->up->cmd2 == c)
+		c->up->cmd2 = by;
+
+	return by;
+}
+
+static command_t *optimize_pipe(command_t *c)
+{
+	simple_command_t *s;
+	word_t *file;
+
+	/* cat FILE | x -> x < FILE, cat | x -> x */
+	if (is_cat_input(c->cmd1, &file) && runs_apart(c->cmd2)) {
+		if (file == NULL)
+			return replace(c, c->cmd2);
+
+		s = pipeline_end(c->cmd2, false);
+		if (s != NULL && s->in == NULL && is_readable(file)) {
+			s->in = file;
+			return replace(c, c->cmd2);
+		}
+	}
+
+	/* x | cat > FILE -> x > FILE, x | cat -> x */
+	if (is_cat_output(c->cmd2) && runs_apart(c->cmd1)) {
+		if (c->cmd2->scmd->out == NULL)
+			return replace(c, c->cmd1);
+
+		s = pipeline_end(c->cmd1, true);
+		if (s != NULL && s->out == NULL && s->err == NULL) {
+			s->out = c->cmd2->scmd->out;
+			s->io_flags |= c->cmd2->scmd->io_flags & IO_OUT_APPEND;
+			return replace(c, c->cmd1);
+		}
+	}
+
+	return c;
+}
+
+/**
+ * Rewrite the node `c` itself, its children being done. Returns the node
+ * now in the place of `c`.
+ */
+static command_t *optimize_op(command_t *c)
+{
+	switch (c->op) {
+	case OP_PIPE:
+		return optimize_pipe(c);
+
+	case OP_SEQUENTIAL:
+		if (is_bare(c->cmd1, "true") || is_bare(c->cmd1, "false"))
+			return replace(c, c->cmd2);
+		break;
+
+	case OP_CONDITIONAL_ZERO:
+		if (is_bare(c->cmd1, "true"))
+			return replace(c, c->cmd2);
+		if (is_bare(c->cmd1, "false") || is_bare(c->cmd2, "true"))
+			return replace(c, c->cmd1);
+		break;
+
+	case OP_CONDITIONAL_NZERO:
+		if (is_bare(c->cmd1, "false"))
+			return replace(c, c->cmd2);
+		if (is_bare(c->cmd1, "true"))
+			return replace(c, c->cmd1);
+		break;
+
+	default:
+		break;
+	}
+
+	return c;
+}
+
+/**
+ * Rewrite the subtree of `c`, children first. Returns the node now in
+ * the place of `c`. A list is a chain down the left side of the tree, as
+ * long as the line (see run_list()), so it is walked down and back up
+ * instead of recursing.
+ */
+static command_t *optimize_node(command_t *c)
+{
+	command_t *node = c, *up;
+
+	if (c == NULL || c->op == OP_NONE)
+		return c;
+
+	if (!is_list(c)) {
+		optimize_node(c->cmd1);
+		optimize_node(c->cmd2);
+		return optimize_op(c);
+	}
+
+	while (is_list(node->cmd1))
+		node = node->cmd1;
+
+	optimize_node(node->cmd1);
+
+	for (;;) {
+		optimize_node(node->cmd2);
+
+		/* The rewrite may take the node out of the tree. */
+		up = node->up;
+		if (node == c)
+			return optimize_op(node);
+		optimize_op(node);
+		node = up;
+	}
+}
+
+static void dump_words(const char *prefix, word_t *w)
+{
+	for (; w != NULL; w = w->next_word) {
+		fputs(prefix, stderr);
+		print_word(stderr, w);
+	}
+}
+
+static void dump_simple(simple_command_t *s)
+{
+	print_word(stderr, s->verb);
+	dump_words(" ", s->params);
+	dump_words(" < ", s->in);
+
+	if (s->out != NULL && s->out == s->err) {
+		dump_words(" &> ", s->out);
+		return;
+	}
+	dump_words(s->io_flags & IO_OUT_APPEND ? " >> " : " > ", s->out);
+	dump_words(s->io_flags & IO_ERR_APPEND ? " 2>> " : " 2> ", s->err);
+}
+
+/**
+ * Print a tree as a command line. The tree has no parentheses: the
+ * operators nest by priority, so writing them in order is enough.
+ */
+static void dump_node(command_t *c)
+{
+	command_t *node = c;
+
+	switch (c->op) {
+	case OP_NONE:
+		dump_simple(c->scmd);
+		break;
+
+	case OP_FOR:
+		fputs("for ", stderr);
+		print_word(stderr, c->scmd->verb);
+		fputs(" in", stderr);
+		dump_words(" ", c->scmd->params);
+		fputs("; do ", stderr);
+		dump_node(c->cmd1);
+		fputs("; done", stderr);
+		break;
+
+	case OP_WHILE:
+		fputs("while ", stderr);
+		dump_node(c->cmd1);
+		fputs("; do ", stderr);
+		dump_node(c->cmd2);
+		fputs("; done", stderr);
+		break;
+
+	default:
+		while (is_list(node) && is_list(node->cmd1))
+			node = node->cmd1;
+
+		dump_node(node->cmd1);
+		for (;;) {
+			fputs(separators[node->op], stderr);
+			dump_node(node->cmd2);
+			if (node == c)
+				break;
+			node = node->up;
+		}
+		break;
+	}
+}
+
+command_t *optimize_command(command_t *root)
+{
+	const char *value = getenv(OPTIMIZE_VAR);
+
+	if (root == NULL || value == NULL || *value == '\0' ||
+	    strcmp(value, "0") == 0)
+		return root;
+
+	root = optimize_node(root);
+
+	if (strcmp(value, OPTIMIZE_DUMP) == 0) {
+		fputs("optimized: ", stderr);
+		dump_node(root);
+		fputc('\n', stderr);
+	}
+
+	return root;
+}
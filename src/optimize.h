@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _OPTIMIZE_H
+#define _OPTIMIZE_H
+
+#include "../util/parser/parser.h"
+
+/**
+ * Rewriting pass over a parsed command tree.
+ *
+ * With MINISHELL_OPTIMIZE set to a non-empty value other than 0, the
+ * tree of each line is rewritten before it runs; each rewrite saves a
+ * process and a pipe:
+ *
+ *   cat FILE | x, cat < FILE | x   ->  x < FILE
+ *   cat | x                        ->  x
+ *   x | cat, x | cat > FILE        ->  x, x > FILE
+ *   true && x, false || x          ->  x
+ *   true ; x, false ; x            ->  x
+ *   x && true                      ->  x
+ *   false && x                     ->  false
+ *   true || x                      ->  true
+ *
+ * Only literal words are considered: `cat` must be written as such,
+ * without options, variables or wildcards, and the command taking over a
+ * redirection must not have one of its own. The pipes are only removed
+ * when what remains still runs in a child: an external command or a
+ * pipeline of its own, not an internal command, an assignment or a loop,
+ * which would then change the shell itself. A FILE that cannot be read
+ * when the line is rewritten keeps its cat, to report the error.
+ *
+ * With MINISHELL_OPTIMIZE=dump, the rewritten line is also printed to
+ * stderr, prefixed with "optimized: ".
+ */
+command_t *optimize_command(command_t *root);
+
+#endif /* _OPTIMIZE_H */
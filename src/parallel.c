@@ -0,0 +1,421 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "stats.h"
+#include "cmd.h"
+#include "utils.h"
+
+#define PLACEHOLDER		"{}"
+#define READ_BLOCK		(64 * 1024)
+#define MAX_FAILED		100
+
+/* A word part containing the placeholder, with its template text. */
+struct subst {
+	word_t *part;
+	const char *text;
+};
+
+struct job {
+	pid_t pid;
+	int pidfd;	/* readable once the job exited */
+	char *item;
+};
+
+struct pool {
+	command_t *root;
+	command_t node;		/* the template, if built from the words */
+	simple_command_t scmd;
+	word_t *words;
+	struct pollfd *polls;
+	size_t *polled;		/* job of each entry of polls */
+	int level;
+	struct subst *substs;
+	size_t nsubsts;
+	struct job *jobs;
+	size_t njobs;
+	size_t running;
+	size_t failed;
+	int null_fd;
+	word_t last_arg;
+};
+
+static void add_parts(struct pool *p, word_t *word)
+{
+	word_t *part;
+
+	for (; word != NULL; word = word->next_word) {
+		for (part = word; part != NULL; part = part->next_part) {
+			if (part->expand || strstr(part->string, PLACEHOLDER) == NULL)
+				continue;
+
+			p->substs = realloc(p->substs,
+					    (p->nsubsts + 1) * sizeof(*p->substs));
+			DIE(p->substs == NULL, "realloc");
+			p->substs[p->nsubsts].part = part;
+			p->substs[p->nsubsts].text = part->string;
+			p->nsubsts++;
+		}
+	}
+}
+
+/**
+ * Find the word parts the items go into, once for the whole run.
+ */
+static void find_placeholders(struct pool *p, command_t *c)
+{
+	simple_command_t *s;
+
+	if (c == NULL)
+		return;
+
+	find_placeholders(p, c->cmd1);
+	find_placeholders(p, c->cmd2);
+
+	s = c->scmd;
+	if (s == NULL)
+		return;
+	add_parts(p, s->verb);
+	add_parts(p, s->params);
+	add_parts(p, s->in);
+	add_parts(p, s->out);
+	add_parts(p, s->err);
+}
+
+static char *replace(const char *text, const char *item)
+{
+	size_t len = strlen(item), size = strlen(text) + 1;
+	const char *from, *at;
+	char *res, *to;
+
+	for (at = strstr(text, PLACEHOLDER); at != NULL;
+	     at = strstr(at + strlen(PLACEHOLDER), PLACEHOLDER))
+		size += len;
+
+	res = malloc(size);
+	DIE(res == NULL, "malloc");
+
+	to = res;
+	for (from = text; (at = strstr(from, PLACEHOLDER)) != NULL;
+	     from = at + strlen(PLACEHOLDER)) {
+		memcpy(to, from, at - from);
+		to += at - from;
+		memcpy(to, item, len);
+		to += len;
+	}
+	strcpy(to, from);
+
+	return res;
+}
+
+/**
+ * Wait for one of the jobs to end. Other children of the shell are left
+ * alone, so the jobs are waited for through their pidfds.
+ */
+static void finish_job(struct pool *p)
+{
+	size_t i, n = 0;
+	int status, code, rc;
+
+	for (i = 0; i < p->njobs; i++) {
+		if (p->jobs[i].pid == 0)
+			continue;
+		p->polls[n].fd = p->jobs[i].pidfd;
+		p->polls[n].events = POLLIN;
+		p->polled[n++] = i;
+	}
+
+	rc = poll(p->polls, n, -1);
+	if (rc < 0) {
+		DIE(errno != EINTR, "poll");
+		return;
+	}
+
+	for (n = 0; p->polls[n].revents == 0; n++)
+		;
+	i = p->polled[n];
+
+	DIE(stats_waitpid(p->jobs[i].pid, &status, 0) < 0, "waitpid");
+	close(p->jobs[i].pidfd);
+
+	if (WIFEXITED(status))
+		code = WEXITSTATUS(status);
+	else
+		code = 128 + WTERMSIG(status);
+
+	if (code != 0) {
+		fprintf(stderr, "parallel: %s: exit status %d\n", p->jobs[i].item, code);
+		p->failed++;
+	}
+
+	free(p->jobs[i].item);
+	p->jobs[i].item = NULL;
+	p->jobs[i].pid = 0;
+	p->running--;
+}
+
+/**
+ * Run the template for an item, waiting for a free job slot first. The
+ * child gets a copy of the tree with the item in place, so the parent
+ * restores the template right after the fork.
+ */
+static void start_job(struct pool *p, const char *item, size_t len)
+{
+	size_t i, j;
+	pid_t pid;
+
+	while (p->running == p->njobs)
+		finish_job(p);
+
+	for (i = 0; p->jobs[i].pid != 0; i++)
+		;
+
+	p->jobs[i].item = strndup(item, len);
+	DIE(p->jobs[i].item == NULL, "strndup");
+
+	for (j = 0; j < p->nsubsts; j++)
+		p->substs[j].part->string = replace(p->substs[j].text, p->jobs[i].item);
+
+	fflush(NULL);
+	pid = stats_fork();
+	DIE(pid < 0, "fork");
+	if (pid == 0) {
+		/* Leave the items to the shell. */
+		dup2(p->null_fd, STDIN_FILENO);
+		exit(parse_command(p->root, p->level + 1, NULL));
+	}
+
+	for (j = 0; j < p->nsubsts; j++) {
+		free((char *)p->substs[j].part->string);
+		p->substs[j].part->string = p->substs[j].text;
+	}
+
+	p->jobs[i].pid = pid;
+	p->jobs[i].pidfd = syscall(SYS_pidfd_open, pid, 0);
+	DIE(p->jobs[i].pidfd < 0, "pidfd_open");
+	p->running++;
+}
+
+/**
+ * Read the items in large blocks and start a job for each line.
+ */
+static void run_items(struct pool *p, int fd)
+{
+	size_t len = 0, size = READ_BLOCK, start, i;
+	char *buf;
+	ssize_t rc;
+
+	buf = malloc(size);
+	DIE(buf == NULL, "malloc");
+
+	for (;;) {
+		if (size - len < READ_BLOCK) {
+			size *= 2;
+			buf = realloc(buf, size);
+			DIE(buf == NULL, "realloc");
+		}
+
+		rc = read(fd, buf + len, size - len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			break;
+
+		start = 0;
+		for (i = len; i < len + rc; i++) {
+			if (buf[i] != '\n')
+				continue;
+			if (i > start)
+				start_job(p, buf + start, i - start);
+			start = i + 1;
+		}
+
+		len += rc - start;
+		memmove(buf, buf + start, len);
+	}
+
+	if (len > 0)
+		start_job(p, buf, len);
+
+	free(buf);
+}
+
+/**
+ * A template without placeholder gets the item as the last argument of
+ * its last command.
+ */
+static void add_last_arg(struct pool *p)
+{
+	command_t *c = p->root;
+	word_t **param;
+
+	while (c->scmd == NULL)
+		c = c->cmd2;
+
+	for (param = &c->scmd->params; *param != NULL; param = &(*param)->next_word)
+		;
+
+	p->last_arg.string = PLACEHOLDER;
+	p->last_arg.quoted = true;
+	*param = &p->last_arg;
+}
+
+/**
+ * Make the template a simple command of the words, as they are: quotes
+ * and the values of variables stay words and never become operators.
+ * The words are copies, so that the last argument can be added.
+ */
+static void build_template(struct pool *p, word_t *word)
+{
+	size_t n = 0, i;
+	word_t *w;
+
+	for (w = word; w != NULL; w = w->next_word)
+		n++;
+
+	p->words = calloc(n, sizeof(*p->words));
+	DIE(p->words == NULL, "calloc");
+	for (i = 0, w = word; w != NULL; i++, w = w->next_word) {
+		p->words[i] = *w;
+		p->words[i].next_word = i + 1 < n ? &p->words[i + 1] : NULL;
+	}
+
+	/* As parsed, the verb is a list of its own. */
+	p->scmd.verb = &p->words[0];
+	p->scmd.params = p->words[0].next_word;
+	p->words[0].next_word = NULL;
+	p->scmd.up = &p->node;
+	p->node.op = OP_NONE;
+	p->node.scmd = &p->scmd;
+	p->root = &p->node;
+}
+
+/**
+ * A template of a single word with blanks, such as "gzip -9 {}", is a
+ * command line of its own, parsed once.
+ */
+static bool parse_template(struct pool *p, word_t *word)
+{
+	char *line;
+	bool ok;
+
+	if (word->next_word != NULL)
+		return false;
+
+	line = get_word(word);
+	if (strpbrk(line, " \t") == NULL) {
+		free(line);
+		return false;
+	}
+
+	ok = stats_parse_line(line, &p->root) && p->root != NULL;
+	free(line);
+	if (!ok)
+		p->root = NULL;
+
+	return true;
+}
+
+int shell_parallel(simple_command_t *s, int level)
+{
+	struct pool p = { .level = level };
+	parse_memory_t *saved;
+	word_t *word = s->params;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	char *arg, *end;
+	int fd = STDIN_FILENO;
+
+	for (; word != NULL; word = word->next_word) {
+		arg = get_word(word);
+		if (strncmp(arg, "-j", 2) != 0) {
+			free(arg);
+			break;
+		}
+
+		if (arg[2] == '\0' && word->next_word != NULL) {
+			word = word->next_word;
+			free(arg);
+			arg = get_word(word);
+			jobs = strtol(arg, &end, 10);
+		} else {
+			jobs = strtol(arg + 2, &end, 10);
+		}
+
+		if (*end != '\0' || end == arg || jobs <= 0) {
+			fprintf(stderr, "parallel: invalid number of jobs\n");
+			free(arg);
+			return 1;
+		}
+		free(arg);
+	}
+
+	if (word == NULL) {
+		fprintf(stderr, "Usage: parallel [-j N] TEMPLATE...\n");
+		return 1;
+	}
+
+	if (s->in != NULL) {
+		arg = get_word(s->in);
+		fd = open(arg, O_RDONLY);
+		if (fd < 0) {
+			perror(arg);
+			free(arg);
+			return 1;
+		}
+		free(arg);
+	}
+
+	/* A parsed template gets a tree of its own, next to the current one. */
+	saved = save_parse_memory();
+	if (!parse_template(&p, word)) {
+		build_template(&p, word);
+	} else if (p.root == NULL) {
+		restore_parse_memory(saved);
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return 1;
+	}
+
+	p.njobs = jobs > 0 ? jobs : 1;
+	p.jobs = calloc(p.njobs, sizeof(*p.jobs));
+	DIE(p.jobs == NULL, "calloc");
+	p.polls = calloc(p.njobs, sizeof(*p.polls));
+	DIE(p.polls == NULL, "calloc");
+	p.polled = calloc(p.njobs, sizeof(*p.polled));
+	DIE(p.polled == NULL, "calloc");
+	p.null_fd = open("/dev/null", O_RDONLY);
+	DIE(p.null_fd < 0, "open");
+
+	find_placeholders(&p, p.root);
+	if (p.nsubsts == 0) {
+		add_last_arg(&p);
+		find_placeholders(&p, p.root);
+	}
+	run_items(&p, fd);
+	while (p.running > 0)
+		finish_job(&p);
+
+	close(p.null_fd);
+	if (fd != STDIN_FILENO)
+		close(fd);
+	free(p.jobs);
+	free(p.polls);
+	free(p.polled);
+	free(p.words);
+	free(p.substs);
+	restore_parse_memory(saved);
+
+	return p.failed > MAX_FAILED ? MAX_FAILED + 1 : p.failed;
+}
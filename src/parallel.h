@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include "../util/parser/parser.h"
+
+/**
+ * Internal parallel command: parallel [-j N] TEMPLATE...
+ *
+ * Runs the template once for every line read from stdin (or the `<`
+ * redirection), with up to N (default: online CPUs) jobs at a time. Each
+ * {} in the template is replaced by the line; a template without {} gets
+ * the line as its last argument. The template runs as the words it is
+ * made of, so quoted text and variables are never parsed as operators;
+ * only a template of a single word with blanks, as in
+ * parallel "gzip -9 {} && rm {}", is parsed as a command line, once.
+ *
+ * Failed items are reported on stderr. Returns the number of failed
+ * items, 101 if more than 100 failed.
+ */
+int shell_parallel(simple_command_t *s, int level);
+
+#endif /* _PARALLEL_H */
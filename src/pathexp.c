@@ -0,0 +1,337 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "pathexp.h"
+#include "utils.h"
+
+/* Big enough to read most directories with a single getdents64 call. */
+#define GETDENTS_BUF_SIZE	(256 * 1024)
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/**
+ * Cached listing of a directory. Names are kept in a single pool, each
+ * one followed by its NUL terminator; offsets[i] is the start of entry i.
+ */
+struct dir_listing {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char *pool;
+	size_t pool_size;
+	size_t pool_cap;
+	size_t *offsets;
+	unsigned char *types;
+	size_t count;
+	struct dir_listing *next;
+};
+
+struct match_list {
+	char **paths;
+	size_t count;
+	size_t size;
+};
+
+static struct dir_listing *dir_cache;
+static char *getdents_buf;
+
+int pathexp_has_magic(const char *pattern)
+{
+	for (; *pattern != '\0'; pattern++) {
+		if (*pattern == '\\' && pattern[1] != '\0')
+			pattern++;
+		else if (*pattern == '*' || *pattern == '?' || *pattern == '[')
+			return 1;
+	}
+
+	return 0;
+}
+
+static void free_listing(struct dir_listing *d)
+{
+	free(d->path);
+	free(d->pool);
+	free(d->offsets);
+	free(d->types);
+	free(d);
+}
+
+void pathexp_flush_cache(void)
+{
+	struct dir_listing *d;
+
+	while (dir_cache != NULL) {
+		d = dir_cache;
+		dir_cache = d->next;
+		free_listing(d);
+	}
+}
+
+static void add_entry(struct dir_listing *d, size_t *entries_size,
+		      const char *name, unsigned char type)
+{
+	size_t len = strlen(name) + 1;
+
+	if (d->count == *entries_size) {
+		*entries_size = *entries_size ? 2 * *entries_size : 64;
+		d->offsets = realloc(d->offsets, *entries_size * sizeof(*d->offsets));
+		d->types = realloc(d->types, *entries_size);
+		DIE(d->offsets == NULL || d->types == NULL, "realloc");
+	}
+
+	if (d->pool_size + len > d->pool_cap) {
+		d->pool_cap = 2 * (d->pool_size + len);
+		d->pool = realloc(d->pool, d->pool_cap);
+		DIE(d->pool == NULL, "realloc");
+	}
+	memcpy(d->pool + d->pool_size, name, len);
+
+	d->offsets[d->count] = d->pool_size;
+	d->types[d->count] = type;
+	d->pool_size += len;
+	d->count++;
+}
+
+/**
+ * Read a whole directory with getdents64. The mtime is taken before
+ * reading, so a concurrent change makes the next lookup scan again.
+ */
+static struct dir_listing *scan_dir(const char *path, int fd,
+				    const struct stat *st)
+{
+	struct dir_listing *d;
+	struct linux_dirent64 *ent;
+	size_t entries_size = 0;
+	long nread, pos;
+
+	if (getdents_buf == NULL) {
+		getdents_buf = malloc(GETDENTS_BUF_SIZE);
+		DIE(getdents_buf == NULL, "malloc");
+	}
+
+	d = calloc(1, sizeof(*d));
+	DIE(d == NULL, "calloc");
+	d->path = strdup(path);
+	DIE(d->path == NULL, "strdup");
+	d->dev = st->st_dev;
+	d->ino = st->st_ino;
+	d->mtime = st->st_mtim;
+
+	for (;;) {
+		nread = syscall(SYS_getdents64, fd, getdents_buf, GETDENTS_BUF_SIZE);
+		if (nread <= 0)
+			break;
+
+		for (pos = 0; pos < nread; pos += ent->d_reclen) {
+			ent = (struct linux_dirent64 *)(getdents_buf + pos);
+			if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+				continue;
+			add_entry(d, &entries_size, ent->d_name, ent->d_type);
+		}
+	}
+
+	return d;
+}
+
+/**
+ * Return the listing of a directory, from the cache if the directory
+ * was not modified since it was scanned.
+ */
+static struct dir_listing *get_listing(const char *path)
+{
+	struct dir_listing *d, **prev;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	for (prev = &dir_cache; *prev != NULL; prev = &(*prev)->next) {
+		d = *prev;
+		if (strcmp(d->path, path) != 0)
+			continue;
+
+		if (d->dev == st.st_dev && d->ino == st.st_ino &&
+		    d->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    d->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			close(fd);
+			return d;
+		}
+
+		/* Stale entry, scan again. */
+		*prev = d->next;
+		free_listing(d);
+		break;
+	}
+
+	d = scan_dir(path, fd, &st);
+	close(fd);
+
+	d->next = dir_cache;
+	dir_cache = d;
+
+	return d;
+}
+
+static void add_match(struct match_list *m, char *path)
+{
+	if (m->count == m->size) {
+		m->size = m->size ? 2 * m->size : 16;
+		m->paths = realloc(m->paths, m->size * sizeof(*m->paths));
+		DIE(m->paths == NULL, "realloc");
+	}
+
+	m->paths[m->count++] = path;
+}
+
+/**
+ * Join a prefix with a (possibly escaped) path component.
+ */
+static char *join(const char *prefix, const char *comp, size_t len,
+		  int unescape, int slash)
+{
+	size_t prefix_len = strlen(prefix);
+	char *path = malloc(prefix_len + len + 2);
+	char *p;
+	size_t i;
+
+	DIE(path == NULL, "malloc");
+	memcpy(path, prefix, prefix_len);
+	p = path + prefix_len;
+
+	for (i = 0; i < len; i++) {
+		if (unescape && comp[i] == '\\' && i + 1 < len)
+			i++;
+		*p++ = comp[i];
+	}
+
+	if (slash)
+		*p++ = '/';
+	*p = '\0';
+
+	return path;
+}
+
+static int is_dir(const char *prefix, const char *name, unsigned char type)
+{
+	struct stat st;
+	char *path;
+	int ret;
+
+	if (type == DT_DIR)
+		return 1;
+	if (type != DT_LNK && type != DT_UNKNOWN)
+		return 0;
+
+	path = join(prefix, name, strlen(name), 0, 0);
+	ret = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+	free(path);
+
+	return ret;
+}
+
+/**
+ * Match the remaining pattern `rest` against the entries found under
+ * `prefix` (empty for the current directory, otherwise ends in '/').
+ */
+static void expand_dir(const char *prefix, const char *rest,
+		       struct match_list *m)
+{
+	struct dir_listing *d;
+	const char *slash, *name;
+	char *comp, *path;
+	struct stat st;
+	size_t len, i;
+
+	if (*rest == '\0') {
+		path = strdup(prefix);
+		DIE(path == NULL, "strdup");
+		add_match(m, path);
+		return;
+	}
+
+	slash = strchr(rest, '/');
+	len = slash ? (size_t)(slash - rest) : strlen(rest);
+	comp = strndup(rest, len);
+	DIE(comp == NULL, "strndup");
+
+	if (!pathexp_has_magic(comp)) {
+		path = join(prefix, comp, len, 1, slash != NULL);
+		if (slash != NULL) {
+			expand_dir(path, slash + 1, m);
+			free(path);
+		} else if (lstat(path, &st) == 0) {
+			add_match(m, path);
+		} else {
+			free(path);
+		}
+		free(comp);
+		return;
+	}
+
+	d = get_listing(*prefix == '\0' ? "." : prefix);
+	for (i = 0; d != NULL && i < d->count; i++) {
+		name = d->pool + d->offsets[i];
+		if (fnmatch(comp, name, FNM_PERIOD) != 0)
+			continue;
+
+		if (slash == NULL) {
+			add_match(m, join(prefix, name, strlen(name), 0, 0));
+		} else if (is_dir(prefix, name, d->types[i])) {
+			path = join(prefix, name, strlen(name), 0, 1);
+			expand_dir(path, slash + 1, m);
+			free(path);
+		}
+	}
+
+	free(comp);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+size_t pathexp_expand(const char *pattern, char ***matches)
+{
+	struct match_list m = { NULL, 0, 0 };
+
+	if (*pattern == '/') {
+		while (*pattern == '/')
+			pattern++;
+		expand_dir("/", pattern, &m);
+	} else {
+		expand_dir("", pattern, &m);
+	}
+
+	if (m.count > 1)
+		qsort(m.paths, m.count, sizeof(*m.paths), compare_paths);
+
+	*matches = m.paths;
+	return m.count;
+}
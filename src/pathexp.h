@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PATHEXP_H
+#define _PATHEXP_H
+
+#include <stddef.h>
+
+/**
+ * Check if a pattern contains unescaped wildcards (*, ? or [).
+ */
+int pathexp_has_magic(const char *pattern);
+
+/**
+ * Expand a pattern to the sorted list of matching paths. Returns the
+ * number of matches; on 0 no memory is allocated and the caller should
+ * keep the word as it was written.
+ */
+size_t pathexp_expand(const char *pattern, char ***matches);
+
+/**
+ * Forget the cached directory listings. Called once per command line.
+ */
+void pathexp_flush_cache(void);
+
+#endif /* _PATHEXP_H */
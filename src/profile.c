@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <unistd.h>
+
+#include "profile.h"
+#include "utils.h"
+
+#define PROFILE_VAR		"MINISHELL_PROFILE"
+#define FOLDED_SUFFIX		".folded"
+
+/* Distinct (line, node) pairs kept; the samples of others are dropped. */
+#define PROFILE_SLOTS		4096
+#define PROFILE_LABEL		128
+
+#define NSEC_PER_USEC		1000
+#define NSEC_PER_MSEC		1000000.0
+
+struct sample {
+	uint64_t key;		/* 0 while the slot is free */
+	unsigned long line;
+	operator_t op;		/* of the node above the command */
+	uint64_t calls;
+	uint64_t wall_ns;
+	uint64_t user_ns;
+	uint64_t sys_ns;
+	uint64_t fork_ns;
+	char label[PROFILE_LABEL];
+};
+
+struct profile {
+	uint64_t dropped;
+	struct sample samples[PROFILE_SLOTS];
+};
+
+static const char * const op_names[OP_DUMMY] = {
+	[OP_NONE] = "simple",
+	[OP_SEQUENTIAL] = "sequence",
+	[OP_PARALLEL] = "parallel",
+	[OP_CONDITIONAL_ZERO] = "and",
+	[OP_CONDITIONAL_NZERO] = "or",
+	[OP_PIPE] = "pipe",
+	[OP_FOR] = "for",
+	[OP_WHILE] = "while",
+};
+
+static struct profile *profile;
+static pid_t owner;
+static unsigned long current_line;
+
+/* Charged to the simple command being run by this process. */
+static uint64_t pending_user, pending_sys, pending_fork;
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+}
+
+/**
+ * Append the word as it was written to the label, which holds `size`
+ * bytes. Returns the new length.
+ */
+static size_t add_word(char *label, size_t len, size_t size, word_t *w)
+{
+	int n;
+
+	for (; w != NULL && len < size - 1; w = w->next_part) {
+		n = snprintf(label + len, size - len, word_part_format(w), w->string);
+		if (n > 0)
+			len = len + n < size - 1 ? len + n : size - 1;
+	}
+
+	return len;
+}
+
+static void make_label(char *label, size_t size, simple_command_t *s)
+{
+	size_t len;
+	word_t *w;
+	char *p;
+
+	label[0] = '\0';
+	len = add_word(label, 0, size, s->verb);
+	for (w = s->params; w != NULL && len < size - 2; w = w->next_word) {
+		label[len++] = ' ';
+		label[len] = '\0';
+		len = add_word(label, len, size, w);
+	}
+
+	/* ; separates the frames of folded stacks. */
+	for (p = label; *p != '\0'; p++)
+		if (*p == ';')
+			*p = ':';
+}
+
+/**
+ * Find the slot of a (line, node) pair, claiming a free one for it.
+ * Returns NULL if the table is full.
+ */
+static struct sample *find_sample(unsigned long line, const void *node,
+				  bool *claimed)
+{
+	uint64_t key = hash_bytes(&node, sizeof(node),
+				  hash_bytes(&line, sizeof(line), HASH_INIT));
+	uint64_t free_key;
+	size_t i, slot;
+
+	key = key ? key : 1;
+	*claimed = false;
+
+	for (i = 0; i < PROFILE_SLOTS; i++) {
+		slot = (key + i) % PROFILE_SLOTS;
+		free_key = 0;
+		if (__atomic_load_n(&profile->samples[slot].key, __ATOMIC_ACQUIRE) == key)
+			return &profile->samples[slot];
+		if (__atomic_compare_exchange_n(&profile->samples[slot].key,
+						&free_key, key, false,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			*claimed = true;
+			return &profile->samples[slot];
+		}
+		if (free_key == key)
+			return &profile->samples[slot];
+	}
+
+	return NULL;
+}
+
+static int compare_wall(const void *a, const void *b)
+{
+	const struct sample *x = *(const struct sample * const *)a;
+	const struct sample *y = *(const struct sample * const *)b;
+
+	if (x->wall_ns != y->wall_ns)
+		return x->wall_ns < y->wall_ns ? 1 : -1;
+	return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static void write_report(FILE *file, struct sample **sorted, size_t n)
+{
+	size_t i;
+
+	fprintf(file, "%6s %8s %12s %12s %12s %10s  %s\n", "line", "calls",
+		"wall ms", "user ms", "sys ms", "fork ms", "command");
+	for (i = 0; i < n; i++)
+		fprintf(file, "%6lu %8" PRIu64 " %12.3f %12.3f %12.3f %10.3f  %s: %s\n",
+			sorted[i]->line, sorted[i]->calls,
+			sorted[i]->wall_ns / NSEC_PER_MSEC,
+			sorted[i]->user_ns / NSEC_PER_MSEC,
+			sorted[i]->sys_ns / NSEC_PER_MSEC,
+			sorted[i]->fork_ns / NSEC_PER_MSEC,
+			op_names[sorted[i]->op], sorted[i]->label);
+
+	if (profile->dropped > 0)
+		fprintf(file, "%" PRIu64 " samples dropped, too many commands\n",
+			profile->dropped);
+}
+
+static void write_folded(FILE *file, struct sample **sorted, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (sorted[i]->wall_ns >= NSEC_PER_USEC)
+			fprintf(file, "line %lu;%s;%s %" PRIu64 "\n",
+				sorted[i]->line, op_names[sorted[i]->op],
+				sorted[i]->label, sorted[i]->wall_ns / NSEC_PER_USEC);
+}
+
+static void dump_at_exit(void)
+{
+	const char *path = getenv(PROFILE_VAR);
+	struct sample **sorted;
+	char *folded_path;
+	size_t i, n = 0;
+	FILE *file;
+
+	/* Subshells exit too, only the shell itself writes the files. */
+	if (getpid() != owner || path == NULL || *path == '\0')
+		return;
+
+	sorted = malloc(PROFILE_SLOTS * sizeof(*sorted));
+	DIE(sorted == NULL, "malloc");
+	for (i = 0; i < PROFILE_SLOTS; i++)
+		if (profile->samples[i].key != 0 && profile->samples[i].calls > 0)
+			sorted[n++] = &profile->samples[i];
+	qsort(sorted, n, sizeof(*sorted), compare_wall);
+
+	file = fopen(path, "w");
+	if (file != NULL) {
+		write_report(file, sorted, n);
+		fclose(file);
+	} else {
+		perror(path);
+	}
+
+	folded_path = malloc(strlen(path) + sizeof(FOLDED_SUFFIX));
+	DIE(folded_path == NULL, "malloc");
+	strcpy(folded_path, path);
+	strcat(folded_path, FOLDED_SUFFIX);
+
+	file = fopen(folded_path, "w");
+	if (file != NULL) {
+		write_folded(file, sorted, n);
+		fclose(file);
+	} else {
+		perror(folded_path);
+	}
+
+	free(folded_path);
+	free(sorted);
+}
+
+void profile_init(void)
+{
+	const char *path = getenv(PROFILE_VAR);
+
+	if (path == NULL || *path == '\0')
+		return;
+
+	profile = mmap(NULL, sizeof(*profile), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	DIE(profile == MAP_FAILED, "mmap");
+
+	owner = getpid();
+	atexit(dump_at_exit);
+}
+
+void profile_line(unsigned long line)
+{
+	current_line = line;
+}
+
+void profile_begin(void)
+{
+	pending_user = 0;
+	pending_sys = 0;
+	pending_fork = 0;
+}
+
+void profile_child(const struct rusage *usage)
+{
+	pending_user += timeval_ns(&usage->ru_utime);
+	pending_sys += timeval_ns(&usage->ru_stime);
+}
+
+void profile_fork(uint64_t ns)
+{
+	pending_fork += ns;
+}
+
+void profile_end(simple_command_t *s, uint64_t wall_ns)
+{
+	struct sample *sample;
+	command_t *node = s->up;
+	bool claimed;
+
+	if (profile == NULL)
+		return;
+
+	sample = find_sample(current_line, node, &claimed);
+	if (sample == NULL) {
+		__atomic_fetch_add(&profile->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (claimed) {
+		sample->line = current_line;
+		sample->op = node != NULL && node->up != NULL ? node->up->op : OP_NONE;
+		make_label(sample->label, sizeof(sample->label), s);
+	}
+
+	__atomic_fetch_add(&sample->wall_ns, wall_ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sample->user_ns, pending_user, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sample->sys_ns, pending_sys, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sample->fork_ns, pending_fork, __ATOMIC_RELAXED);
+	/* Last, so that a counted sample has its label. */
+	__atomic_fetch_add(&sample->calls, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdint.h>
+
+#include <sys/resource.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Line-level profiler.
+ *
+ * With MINISHELL_PROFILE naming a file, the shell attributes the time of
+ * every simple command to its line of input and to its node in the
+ * command tree: the number of runs, the wall time, the user and system
+ * time of the children it waited for (from wait4()) and the time spent
+ * in fork(). Commands run by subshells (pipes, &) are counted too, as
+ * the samples live in a shared mapping like the stats counters.
+ *
+ * When the shell exits, a report sorted by wall time is written to the
+ * file, and the wall times in microseconds to the file with a .folded
+ * suffix, one "line N;operator;command count" stack per node, the
+ * format flamegraph tools read.
+ */
+
+/**
+ * Map the shared samples if profiling is enabled. Call once, in the main
+ * shell process, before forking.
+ */
+void profile_init(void);
+
+/**
+ * Number of the input line run next, starting from 1.
+ */
+void profile_line(unsigned long line);
+
+/**
+ * Start timing a simple command; the children it waits for and forks
+ * from now on are charged to it.
+ */
+void profile_begin(void);
+
+/**
+ * Charge the resources of a child reaped by wait4().
+ */
+void profile_child(const struct rusage *usage);
+
+/**
+ * Charge the time a fork() took.
+ */
+void profile_fork(uint64_t ns);
+
+/**
+ * Record the simple command `s`, run for `wall_ns` since profile_begin().
+ */
+void profile_end(simple_command_t *s, uint64_t wall_ns);
+
+#endif /* _PROFILE_H */
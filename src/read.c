@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "read.h"
+#include "utils.h"
+
+#define READ_BLOCK		(64 * 1024)
+#define DEFAULT_IFS		" \t\n"
+#define DEFAULT_NAME		"REPLY"
+#define IFS_WHITESPACE		" \t\n"
+
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+/* The last block read from a file, kept for its next lines. */
+static struct {
+	char buf[READ_BLOCK];
+	size_t len;
+	off_t start;		/* offset of buf[0] in the file */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	bool valid;
+} block;
+
+/* Where the data waiting in a pipe is copied to, to look at it. */
+static int peek_pipe[2] = { -1, -1 };
+static char peek_buf[READ_BLOCK];
+
+static void append(struct text *t, const char *buf, size_t len)
+{
+	if (t->len + len + 1 > t->size) {
+		t->size = t->size ? t->size : 128;
+		while (t->len + len + 1 > t->size)
+			t->size *= 2;
+		t->buf = realloc(t->buf, t->size);
+		DIE(t->buf == NULL, "realloc");
+	}
+
+	memcpy(t->buf + t->len, buf, len);
+	t->len += len;
+	t->buf[t->len] = '\0';
+}
+
+static bool same_file(const struct stat *st)
+{
+	return block.valid && block.dev == st->st_dev && block.ino == st->st_ino &&
+	       block.size == st->st_size &&
+	       block.mtime.tv_sec == st->st_mtim.tv_sec &&
+	       block.mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * Read a line from a file in blocks, leaving the offset right after it.
+ * Returns -1 if the file cannot be positioned.
+ */
+static int read_file(int fd, const struct stat *st, struct text *t)
+{
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+	const char *from, *newline;
+	size_t avail;
+	ssize_t n;
+
+	if (pos < 0)
+		return -1;
+
+	for (;;) {
+		if (!same_file(st) || pos < block.start ||
+		    pos >= block.start + (off_t)block.len) {
+			do {
+				n = pread(fd, block.buf, sizeof(block.buf), pos);
+			} while (n < 0 && errno == EINTR);
+
+			if (n <= 0) {
+				block.valid = false;
+				lseek(fd, pos, SEEK_SET);
+				return READ_EOF;
+			}
+
+			block.len = n;
+			block.start = pos;
+			block.dev = st->st_dev;
+			block.ino = st->st_ino;
+			block.size = st->st_size;
+			block.mtime = st->st_mtim;
+			block.valid = true;
+		}
+
+		from = block.buf + (pos - block.start);
+		avail = block.len - (pos - block.start);
+		newline = memchr(from, '\n', avail);
+		if (newline != NULL) {
+			append(t, from, newline - from);
+			lseek(fd, pos + (newline - from) + 1, SEEK_SET);
+			return READ_LINE;
+		}
+
+		append(t, from, avail);
+		pos += avail;
+	}
+}
+
+/**
+ * Take exactly `len` bytes from the pipe, which holds at least as many.
+ */
+static void consume(int fd, size_t len)
+{
+	char buf[4096];
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		DIE(n <= 0, "read");
+		len -= n;
+	}
+}
+
+/**
+ * Read a line from a pipe: tee() copies what waits in it without taking
+ * it, then only the line is taken. Returns -1 if `fd` is not a pipe.
+ */
+static int read_pipe(int fd, struct text *t)
+{
+	const char *newline;
+	ssize_t n, got, rc;
+	size_t len;
+
+	if (peek_pipe[PIPE_READ] < 0)
+		DIE(pipe2(peek_pipe, O_CLOEXEC) < 0, "pipe2");
+
+	for (;;) {
+		do {
+			n = tee(fd, peek_pipe[PIPE_WRITE], sizeof(peek_buf), 0);
+		} while (n < 0 && errno == EINTR);
+		if (n < 0)
+			return t->len == 0 ? -1 : READ_EOF;
+		if (n == 0)
+			return READ_EOF;
+
+		for (got = 0; got < n; got += rc) {
+			rc = read(peek_pipe[PIPE_READ], peek_buf + got, n - got);
+			if (rc < 0 && errno == EINTR)
+				rc = 0;
+			DIE(rc < 0, "read");
+		}
+
+		newline = memchr(peek_buf, '\n', n);
+		len = newline != NULL ? (size_t)(newline - peek_buf) : (size_t)n;
+		append(t, peek_buf, len);
+		consume(fd, newline != NULL ? len + 1 : len);
+
+		if (newline != NULL)
+			return READ_LINE;
+	}
+}
+
+/**
+ * Read a line a byte at a time, for the inputs that cannot be peeked at.
+ */
+static int read_bytes(int fd, struct text *t)
+{
+	ssize_t n;
+	char c;
+
+	for (;;) {
+		n = read(fd, &c, 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return READ_EOF;
+		if (c == '\n')
+			return READ_LINE;
+		append(t, &c, 1);
+	}
+}
+
+static int read_stream(FILE *stream, struct text *t)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t n;
+
+	n = getline(&line, &size, stream);
+	if (n <= 0) {
+		free(line);
+		return READ_EOF;
+	}
+
+	if (line[n - 1] == '\n') {
+		append(t, line, n - 1);
+		free(line);
+		return READ_LINE;
+	}
+
+	append(t, line, n);
+	free(line);
+	return READ_EOF;
+}
+
+static int read_physical(FILE *stream, int fd, struct text *t)
+{
+	struct stat st;
+	int ret = -1;
+
+	if (stream != NULL)
+		return read_stream(stream, t);
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		ret = read_file(fd, &st, t);
+	else if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+		ret = read_pipe(fd, t);
+
+	return ret >= 0 ? ret : read_bytes(fd, t);
+}
+
+int read_input(FILE *stream, int fd, bool raw, char **line)
+{
+	struct text t = { NULL, 0, 0 };
+	size_t slashes;
+	int ret;
+
+	append(&t, "", 0);
+
+	for (;;) {
+		ret = read_physical(stream, fd, &t);
+		if (raw || ret != READ_LINE)
+			break;
+
+		/* An odd number of backslashes ends with an escaped newline. */
+		for (slashes = 0; slashes < t.len && t.buf[t.len - slashes - 1] == '\\';)
+			slashes++;
+		if (slashes % 2 == 0)
+			break;
+		t.buf[--t.len] = '\0';
+	}
+
+	*line = t.buf;
+	return ret;
+}
+
+static bool is_name(const char *name)
+{
+	const char *p;
+
+	if (!isalpha((unsigned char)*name) && *name != '_')
+		return false;
+	for (p = name + 1; *p != '\0'; p++)
+		if (!isalnum((unsigned char)*p) && *p != '_')
+			return false;
+
+	return true;
+}
+
+/**
+ * Remove the backslashes of `line` into `text`; `literal` tells which
+ * characters were escaped, those do not split fields.
+ */
+static size_t unescape(const char *line, bool raw, char *text, char *literal)
+{
+	size_t len = 0;
+
+	for (; *line != '\0'; line++, len++) {
+		literal[len] = !raw && *line == '\\' && line[1] != '\0';
+		if (literal[len])
+			line++;
+		text[len] = *line;
+	}
+	text[len] = '\0';
+
+	return len;
+}
+
+bool read_assign(word_t *names, const char *line, bool raw)
+{
+	const char *ifs = getenv("IFS");
+	size_t len, i = 0, start, end;
+	char *text, *literal, *name;
+	word_t *w;
+	bool ok = true;
+
+	if (ifs == NULL)
+		ifs = DEFAULT_IFS;
+
+	text = malloc(strlen(line) + 1);
+	literal = malloc(strlen(line) + 1);
+	DIE(text == NULL || literal == NULL, "malloc");
+	len = unescape(line, raw, text, literal);
+
+#define IS_IFS(c, l)	(!(l) && (c) != '\0' && strchr(ifs, (c)) != NULL)
+#define IS_SPACE(c, l)	(IS_IFS(c, l) && strchr(IFS_WHITESPACE, (c)) != NULL)
+
+	if (names == NULL) {
+		setenv(DEFAULT_NAME, text, 1);
+		goto out;
+	}
+
+	while (i < len && IS_SPACE(text[i], literal[i]))
+		i++;
+
+	for (w = names; w != NULL; w = w->next_word) {
+		name = get_word(w);
+		if (!is_name(name)) {
+			fprintf(stderr, "read: '%s': not a valid identifier\n", name);
+			free(name);
+			ok = false;
+			continue;
+		}
+
+		start = i;
+		if (w->next_word == NULL) {
+			/* The last one takes the rest, without trailing blanks. */
+			end = len;
+			while (end > start && IS_SPACE(text[end - 1], literal[end - 1]))
+				end--;
+			i = len;
+		} else {
+			while (i < len && !IS_IFS(text[i], literal[i]))
+				i++;
+			end = i;
+
+			while (i < len && IS_SPACE(text[i], literal[i]))
+				i++;
+			if (i < len && IS_IFS(text[i], literal[i])) {
+				i++;
+				while (i < len && IS_SPACE(text[i], literal[i]))
+					i++;
+			}
+		}
+
+		text[end] = '\0';
+		setenv(name, text + start, 1);
+		free(name);
+	}
+
+#undef IS_SPACE
+#undef IS_IFS
+
+out:
+	free(text);
+	free(literal);
+
+	return ok;
+}
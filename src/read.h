@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _READ_H
+#define _READ_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Input of the read internal command.
+ *
+ * read [-r] [NAME]... takes one line of its input, splits it into fields
+ * by the characters of IFS (space, tab and newline if unset) and sets the
+ * variables in turn, the last one to the rest of the line; REPLY if no
+ * name is given. Without -r, a backslash keeps the next character from
+ * splitting and a backslash at the end of the line joins the next one.
+ *
+ * Unlike shells reading a byte at a time, so that the commands run next
+ * find the input right after the line, the line is found in blocks:
+ *
+ *  - from a file, a block is read and the offset set back to just past
+ *    the newline; the block is kept for the next lines while the file
+ *    does not change and nobody else moves the offset;
+ *  - from a pipe, the waiting data is peeked with tee() into a pipe of
+ *    the shell, then exactly the line is consumed;
+ *  - from a pipeline stage run in the shell (see ring.h), the stream of
+ *    the ring buffer is read, as nothing else can read it;
+ *  - from anything else (terminals, sockets), a byte at a time.
+ */
+
+/* Status of read_input(). */
+#define READ_LINE		0	/* a whole line was read */
+#define READ_EOF		1	/* the end of input came first */
+
+/**
+ * Read a line of `stream` if not NULL, else of the descriptor `fd`, into
+ * the allocated `*line`, without the newline. Joins continued lines
+ * unless `raw`. Returns READ_LINE or READ_EOF; on READ_EOF, `*line` has
+ * whatever came before the end of input.
+ */
+int read_input(FILE *stream, int fd, bool raw, char **line);
+
+/**
+ * Set the variables `names` (REPLY if NULL) to the fields of `line`.
+ * Returns false if a name is not a valid variable name.
+ */
+bool read_assign(word_t *names, const char *line, bool raw);
+
+#endif /* _READ_H */
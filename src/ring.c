@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include <sys/mman.h>
+
+#include "ring.h"
+#include "utils.h"
+
+/* Like a default pipe; a power of two, the indices wrap with a mask. */
+#define RING_SIZE		(64 * 1024)
+#define STACK_SIZE		(256 * 1024)
+
+struct ring {
+	char buf[RING_SIZE];
+	size_t head;		/* bytes written so far */
+	size_t tail;		/* bytes read so far */
+	bool writer_done;
+	bool reader_done;
+};
+
+struct coroutine {
+	ucontext_t context;
+	void *stack;
+	FILE *in;
+	FILE *out;
+	bool done;
+};
+
+static struct ring_stage *stages;
+static struct coroutine *coroutines;
+static size_t current;
+static bool active;
+static ucontext_t scheduler;
+
+/**
+ * Let the other stages run, until the scheduler comes back to this one.
+ */
+static void switch_stage(void)
+{
+	DIE(swapcontext(&coroutines[current].context, &scheduler) < 0,
+	    "swapcontext");
+}
+
+static size_t ring_put(struct ring *r, const char *buf, size_t len)
+{
+	size_t space = RING_SIZE - (r->head - r->tail);
+	size_t at = r->head & (RING_SIZE - 1), first;
+
+	len = len < space ? len : space;
+	first = len < RING_SIZE - at ? len : RING_SIZE - at;
+	memcpy(r->buf + at, buf, first);
+	memcpy(r->buf, buf + first, len - first);
+	r->head += len;
+
+	return len;
+}
+
+static size_t ring_get(struct ring *r, char *buf, size_t len)
+{
+	size_t used = r->head - r->tail;
+	size_t at = r->tail & (RING_SIZE - 1), first;
+
+	len = len < used ? len : used;
+	first = len < RING_SIZE - at ? len : RING_SIZE - at;
+	memcpy(buf, r->buf + at, first);
+	memcpy(buf + first, r->buf, len - first);
+	r->tail += len;
+
+	return len;
+}
+
+static ssize_t ring_write(void *cookie, const char *buf, size_t size)
+{
+	struct ring *r = cookie;
+	size_t done = 0, n;
+
+	while (done < size) {
+		if (r->reader_done) {
+			errno = EPIPE;
+			return done > 0 ? (ssize_t)done : -1;
+		}
+
+		n = ring_put(r, buf + done, size - done);
+		if (n == 0)
+			switch_stage();
+		done += n;
+	}
+
+	return done;
+}
+
+static ssize_t ring_read(void *cookie, char *buf, size_t size)
+{
+	struct ring *r = cookie;
+
+	while (r->head == r->tail) {
+		if (r->writer_done)
+			return 0;
+		switch_stage();
+	}
+
+	return ring_get(r, buf, size);
+}
+
+static int ring_close_writer(void *cookie)
+{
+	((struct ring *)cookie)->writer_done = true;
+	return 0;
+}
+
+static int ring_close_reader(void *cookie)
+{
+	((struct ring *)cookie)->reader_done = true;
+	return 0;
+}
+
+static void stage_main(void)
+{
+	struct coroutine *c = &coroutines[current];
+	struct ring_stage *s = &stages[current];
+
+	s->status = s->run(s->arg);
+
+	/* The reader sees the end of file once the rest is flushed. */
+	if (c->out != NULL)
+		fclose(c->out);
+	else
+		fflush(stdout);
+	if (c->in != NULL)
+		fclose(c->in);
+
+	c->done = true;
+}
+
+int ring_run(struct ring_stage *st, size_t n)
+{
+	static const cookie_io_functions_t writer = {
+		.write = ring_write,
+		.close = ring_close_writer,
+	};
+	static const cookie_io_functions_t reader = {
+		.read = ring_read,
+		.close = ring_close_reader,
+	};
+	struct ring *rings;
+	/* Live across swapcontext(), which returns like setjmp() does. */
+	volatile size_t running = n;
+	size_t i;
+
+	DIE(active, "ring_run");
+
+	coroutines = calloc(n, sizeof(*coroutines));
+	DIE(coroutines == NULL, "calloc");
+	rings = calloc(n - 1, sizeof(*rings));
+	DIE(n > 1 && rings == NULL, "calloc");
+
+	for (i = 0; i < n; i++) {
+		if (i > 0) {
+			coroutines[i].in = fopencookie(&rings[i - 1], "r", reader);
+			DIE(coroutines[i].in == NULL, "fopencookie");
+		}
+		if (i < n - 1) {
+			coroutines[i].out = fopencookie(&rings[i], "w", writer);
+			DIE(coroutines[i].out == NULL, "fopencookie");
+		}
+
+		coroutines[i].stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+					   -1, 0);
+		DIE(coroutines[i].stack == MAP_FAILED, "mmap");
+
+		DIE(getcontext(&coroutines[i].context) < 0, "getcontext");
+		coroutines[i].context.uc_stack.ss_sp = coroutines[i].stack;
+		coroutines[i].context.uc_stack.ss_size = STACK_SIZE;
+		coroutines[i].context.uc_link = &scheduler;
+		makecontext(&coroutines[i].context, stage_main, 0);
+	}
+
+	stages = st;
+	active = true;
+
+	/* Round robin; a stage runs until it blocks on a ring or ends. */
+	while (running > 0) {
+		for (i = 0; i < n; i++) {
+			if (coroutines[i].done)
+				continue;
+
+			current = i;
+			DIE(swapcontext(&scheduler, &coroutines[i].context) < 0,
+			    "swapcontext");
+			if (coroutines[i].done) {
+				munmap(coroutines[i].stack, STACK_SIZE);
+				running--;
+			}
+		}
+	}
+
+	active = false;
+	free(rings);
+	free(coroutines);
+
+	return st[n - 1].status;
+}
+
+FILE *ring_stdin(void)
+{
+	return active ? coroutines[current].in : NULL;
+}
+
+FILE *ring_stdout(void)
+{
+	return active ? coroutines[current].out : NULL;
+}
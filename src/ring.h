@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * In-process pipes between internal commands.
+ *
+ * Adjacent stages of a pipeline that are internal commands writing and
+ * reading through stdio run in one process, as coroutines (ucontext) of
+ * a single thread. Each pair of stages is connected by a ring buffer the
+ * size of a pipe with one writer and one reader, wrapped in stdio streams
+ * (fopencookie()). A stage writing to a full ring or reading from an
+ * empty one switches to the next stage that can go on, so the data never
+ * goes through the kernel. Like with a pipe, a reader sees the end of
+ * file once its writer ended, and writing fails with EPIPE once the
+ * reader ended.
+ *
+ * The first stage reads the process' stdin and the last one writes to
+ * its stdout, through a kernel pipe when the neighbouring stage is an
+ * external command.
+ */
+
+struct ring_stage {
+	int (*run)(void *arg);
+	void *arg;
+	int status;
+};
+
+/**
+ * Run the stages connected by ring buffers until they all ended. Returns
+ * the status of the last one.
+ */
+int ring_run(struct ring_stage *stages, size_t n);
+
+/**
+ * The stream the running stage reads from, NULL if it reads stdin.
+ */
+FILE *ring_stdin(void);
+
+/**
+ * The stream the running stage writes to, NULL if it writes to stdout.
+ */
+FILE *ring_stdout(void);
+
+#endif /* _RING_H */
@@ -0,0 +1,872 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "scache.h"
+#include "stats.h"
+#include "utils.h"
+
+#define SCACHE_MAGIC		"MSHSCv1"
+#define SCACHE_VERSION		4
+#define SCACHE_SUFFIX		".msc"
+
+#define ALIGN8(x)		(((x) + 7) & ~(size_t)7)
+
+/* Bumps whenever one of the parser structures changes size. */
+#define SCACHE_LAYOUT		((uint32_t)(sizeof(command_t) |		\
+					    sizeof(simple_command_t) << 8 |	\
+					    sizeof(word_t) << 16 |		\
+					    sizeof(void *) << 24))
+
+enum {
+	REC_COMMAND = 1,
+	REC_SIMPLE,
+	REC_WORD,
+	REC_STRING,
+};
+
+/**
+ * File layout: the header, then the records holding the parser
+ * structures and strings, then the line table. Pointer fields hold the
+ * offset of the record they point to (0 is NULL, the header is there).
+ */
+struct scache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout;
+	uint64_t script_size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t hash;
+	uint64_t path;
+	uint64_t nlines;
+	uint64_t lines;
+	uint64_t size;
+};
+
+struct scache_record {
+	uint32_t type;
+	uint32_t size;
+};
+
+struct scache_line {
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t offset;
+};
+
+struct script {
+	char *base;
+	size_t size;
+	bool mapped;
+	struct scache_line *lines;
+	size_t nlines;
+};
+
+struct ptr_map {
+	uintptr_t *keys;
+	uint64_t *values;
+	size_t size;
+	size_t count;
+};
+
+struct pending {
+	uint32_t type;
+	bool done;
+	const void *ptr;
+};
+
+struct pending_list {
+	struct pending *items;
+	size_t len;
+	size_t cap;
+};
+
+struct writer {
+	char *buf;
+	size_t len;
+	size_t cap;
+	struct ptr_map map;
+	struct pending_list stack;
+	struct pending_list order;
+};
+
+/* Map value of a node being visited, before it has an offset. */
+#define VISITED			1
+
+static size_t map_slot(struct ptr_map *m, uintptr_t key)
+{
+	size_t i = (key >> 3) * 0x9e3779b97f4a7c15ULL & (m->size - 1);
+
+	while (m->keys[i] != 0 && m->keys[i] != key)
+		i = (i + 1) & (m->size - 1);
+
+	return i;
+}
+
+static void map_put(struct ptr_map *m, const void *ptr, uint64_t value)
+{
+	struct ptr_map old = *m;
+	size_t i;
+
+	if (2 * (m->count + 1) > m->size) {
+		m->size = m->size ? 2 * m->size : 1024;
+		m->keys = calloc(m->size, sizeof(*m->keys));
+		m->values = malloc(m->size * sizeof(*m->values));
+		DIE(m->keys == NULL || m->values == NULL, "calloc");
+
+		for (i = 0; i < old.size; i++) {
+			if (old.keys[i] != 0) {
+				size_t j = map_slot(m, old.keys[i]);
+
+				m->keys[j] = old.keys[i];
+				m->values[j] = old.values[i];
+			}
+		}
+		free(old.keys);
+		free(old.values);
+	}
+
+	i = map_slot(m, (uintptr_t)ptr);
+	if (m->keys[i] == 0)
+		m->count++;
+	m->keys[i] = (uintptr_t)ptr;
+	m->values[i] = value;
+}
+
+static uint64_t map_get(struct ptr_map *m, const void *ptr)
+{
+	size_t i;
+
+	if (m->size == 0)
+		return 0;
+	i = map_slot(m, (uintptr_t)ptr);
+
+	return m->keys[i] != 0 ? m->values[i] : 0;
+}
+
+static void map_clear(struct ptr_map *m)
+{
+	if (m->count == 0)
+		return;
+	memset(m->keys, 0, m->size * sizeof(*m->keys));
+	m->count = 0;
+}
+
+static uint64_t append(struct writer *w, uint32_t type, const void *data,
+		       size_t size)
+{
+	size_t need = sizeof(struct scache_record) + ALIGN8(size);
+	struct scache_record rec = { type, ALIGN8(size) };
+
+	if (w->len + need > w->cap) {
+		w->cap = 2 * (w->len + need);
+		w->buf = realloc(w->buf, w->cap);
+		DIE(w->buf == NULL, "realloc");
+	}
+
+	memcpy(w->buf + w->len, &rec, sizeof(rec));
+	w->len += sizeof(rec);
+	memset(w->buf + w->len, 0, ALIGN8(size));
+	memcpy(w->buf + w->len, data, size);
+	w->len += ALIGN8(size);
+
+	return w->len - ALIGN8(size);
+}
+
+static void add_pending(struct pending_list *l, uint32_t type,
+			const void *ptr, bool done)
+{
+	if (l->len == l->cap) {
+		l->cap = l->cap ? 2 * l->cap : 256;
+		l->items = realloc(l->items, l->cap * sizeof(*l->items));
+		DIE(l->items == NULL, "realloc");
+	}
+
+	l->items[l->len].type = type;
+	l->items[l->len].done = done;
+	l->items[l->len].ptr = ptr;
+	l->len++;
+}
+
+static void push(struct writer *w, uint32_t type, const void *ptr)
+{
+	if (ptr != NULL && map_get(&w->map, ptr) == 0)
+		add_pending(&w->stack, type, ptr, false);
+}
+
+static size_t record_size(const struct pending *item)
+{
+	switch (item->type) {
+	case REC_COMMAND:
+		return sizeof(command_t);
+	case REC_SIMPLE:
+		return sizeof(simple_command_t);
+	case REC_WORD:
+		return sizeof(word_t);
+	default:
+		return strlen(item->ptr) + 1;
+	}
+}
+
+/**
+ * Replace the pointer stored in `field` by the offset of its record.
+ */
+static void to_offset(struct writer *w, void *field)
+{
+	void *ptr;
+	uint64_t off;
+
+	memcpy(&ptr, field, sizeof(ptr));
+	off = ptr ? map_get(&w->map, ptr) : 0;
+	DIE(ptr != NULL && off == 0, "script cache: dangling pointer");
+	memcpy(field, &(uintptr_t){ off }, sizeof(ptr));
+}
+
+/**
+ * Append the records of a parse tree. Nodes are visited with an explicit
+ * stack, words shared by several lists (&>) are stored once. Records go
+ * in reverse post-order, so each one comes before all it points to but
+ * `up`, which relocate() relies on to rule out cycles.
+ */
+static uint64_t write_tree(struct writer *w, command_t *root)
+{
+	size_t start = w->len, pos;
+	struct scache_record *rec;
+	struct pending item;
+	command_t *c;
+	simple_command_t *s;
+	word_t *word;
+	uint64_t off;
+
+	map_clear(&w->map);
+	push(w, REC_COMMAND, root);
+
+	while (w->stack.len > 0) {
+		item = w->stack.items[--w->stack.len];
+		if (item.done) {
+			add_pending(&w->order, item.type, item.ptr, true);
+			continue;
+		}
+		if (map_get(&w->map, item.ptr) != 0)
+			continue;
+
+		map_put(&w->map, item.ptr, VISITED);
+		add_pending(&w->stack, item.type, item.ptr, true);
+
+		switch (item.type) {
+		case REC_COMMAND:
+			c = (command_t *)item.ptr;
+			push(w, REC_COMMAND, c->cmd1);
+			push(w, REC_COMMAND, c->cmd2);
+			push(w, REC_SIMPLE, c->scmd);
+			break;
+		case REC_SIMPLE:
+			s = (simple_command_t *)item.ptr;
+			push(w, REC_WORD, s->verb);
+			push(w, REC_WORD, s->params);
+			push(w, REC_WORD, s->in);
+			push(w, REC_WORD, s->out);
+			push(w, REC_WORD, s->err);
+			break;
+		case REC_WORD:
+			word = (word_t *)item.ptr;
+			push(w, REC_STRING, word->string);
+			push(w, REC_WORD, word->next_part);
+			push(w, REC_WORD, word->next_word);
+			break;
+		}
+	}
+
+	while (w->order.len > 0) {
+		item = w->order.items[--w->order.len];
+		off = append(w, item.type, item.ptr, record_size(&item));
+		map_put(&w->map, item.ptr, off);
+	}
+
+	for (pos = start; pos < w->len; pos += sizeof(*rec) + rec->size) {
+		rec = (struct scache_record *)(w->buf + pos);
+
+		switch (rec->type) {
+		case REC_COMMAND:
+			c = (command_t *)(rec + 1);
+			to_offset(w, &c->up);
+			to_offset(w, &c->cmd1);
+			to_offset(w, &c->cmd2);
+			to_offset(w, &c->scmd);
+			c->aux = NULL;
+			break;
+		case REC_SIMPLE:
+			s = (simple_command_t *)(rec + 1);
+			to_offset(w, &s->verb);
+			to_offset(w, &s->params);
+			to_offset(w, &s->in);
+			to_offset(w, &s->out);
+			to_offset(w, &s->err);
+			to_offset(w, &s->up);
+			s->aux = NULL;
+			break;
+		case REC_WORD:
+			word = (word_t *)(rec + 1);
+			to_offset(w, &word->string);
+			to_offset(w, &word->next_part);
+			to_offset(w, &word->next_word);
+			break;
+		}
+	}
+
+	return map_get(&w->map, root);
+}
+
+/**
+ * Check every record and note its type by the offset of its data, which
+ * is what pointer fields hold. Returns NULL if a record is malformed.
+ */
+static uint8_t *record_types(char *base, size_t limit)
+{
+	struct scache_record *rec;
+	uint8_t *types;
+	size_t pos, min;
+
+	types = calloc(limit / 8 + 1, 1);
+	DIE(types == NULL, "calloc");
+
+	for (pos = ALIGN8(sizeof(struct scache_header)); pos < limit; pos += sizeof(*rec) + rec->size) {
+		rec = (struct scache_record *)(base + pos);
+		if (pos + sizeof(*rec) > limit || rec->size > limit - pos - sizeof(*rec))
+			goto bad;
+
+		switch (rec->type) {
+		case REC_COMMAND:
+			min = sizeof(command_t);
+			break;
+		case REC_SIMPLE:
+			min = sizeof(simple_command_t);
+			break;
+		case REC_WORD:
+			min = sizeof(word_t);
+			break;
+		case REC_STRING:
+			min = 1;
+			if (memchr(rec + 1, '\0', rec->size) == NULL)
+				goto bad;
+			break;
+		default:
+			goto bad;
+		}
+		if (rec->size < min || rec->size % 8 != 0)
+			goto bad;
+		types[(pos + sizeof(*rec)) / 8] = rec->type;
+	}
+
+	return types;
+
+bad:
+	free(types);
+	return NULL;
+}
+
+/**
+ * Turn the offset stored in `field` of the record at `from` back into a
+ * pointer to a record of `type`. The writer appends a node before its
+ * children, so a child must come after `from` and `up` before it: a
+ * damaged file cannot make the shell walk in circles.
+ */
+static bool to_pointer(char *base, const uint8_t *types, size_t limit,
+		       uint64_t from, void *field, uint32_t type, bool child)
+{
+	uintptr_t off;
+
+	memcpy(&off, field, sizeof(off));
+	if (off == 0)
+		return true;
+	if (off >= limit || off % 8 != 0 || types[off / 8] != type)
+		return false;
+	if (child ? off <= from : off >= from)
+		return false;
+
+	off += (uintptr_t)base;
+	memcpy(field, &off, sizeof(off));
+
+	return true;
+}
+
+/**
+ * Check the shape parser.h promises for each operator, which the shell
+ * relies on when it walks the tree.
+ */
+static bool is_well_formed(const command_t *c)
+{
+	switch (c->op) {
+	case OP_NONE:
+		return c->scmd != NULL && c->cmd1 == NULL && c->cmd2 == NULL;
+	case OP_FOR:
+		return c->scmd != NULL && c->cmd1 != NULL && c->cmd2 == NULL;
+	default:
+		return c->op > OP_NONE && c->op < OP_DUMMY && c->scmd == NULL &&
+		       c->cmd1 != NULL && c->cmd2 != NULL;
+	}
+}
+
+/* Children come later, so their `up` still holds an offset. */
+#define IS_PARENT(child, from)	((child) == NULL || (uintptr_t)(child)->up == (from))
+
+static bool relocate(char *base, size_t size)
+{
+	struct scache_header *h = (struct scache_header *)base;
+	struct scache_record *rec;
+	struct scache_line *lines;
+	size_t pos, i, limit = h->lines;
+	uint64_t from, off;
+	uint8_t *types;
+	command_t *c;
+	simple_command_t *s;
+	word_t *word;
+	bool ok = true;
+
+	if (h->lines > size || h->nlines > (size - h->lines) / sizeof(struct scache_line))
+		return false;
+
+	types = record_types(base, limit);
+	if (types == NULL)
+		return false;
+
+	for (pos = ALIGN8(sizeof(*h)); ok && pos < limit; pos += sizeof(*rec) + rec->size) {
+		rec = (struct scache_record *)(base + pos);
+		from = pos + sizeof(*rec);
+
+		switch (rec->type) {
+		case REC_COMMAND:
+			c = (command_t *)(rec + 1);
+			ok = to_pointer(base, types, limit, from, &c->up, REC_COMMAND, false) &&
+			     to_pointer(base, types, limit, from, &c->cmd1, REC_COMMAND, true) &&
+			     to_pointer(base, types, limit, from, &c->cmd2, REC_COMMAND, true) &&
+			     to_pointer(base, types, limit, from, &c->scmd, REC_SIMPLE, true) &&
+			     is_well_formed(c) && (c->cmd2 == NULL || c->cmd1 != c->cmd2) &&
+			     IS_PARENT(c->cmd1, from) && IS_PARENT(c->cmd2, from) &&
+			     IS_PARENT(c->scmd, from);
+			break;
+		case REC_SIMPLE:
+			s = (simple_command_t *)(rec + 1);
+			ok = to_pointer(base, types, limit, from, &s->verb, REC_WORD, true) &&
+			     to_pointer(base, types, limit, from, &s->params, REC_WORD, true) &&
+			     to_pointer(base, types, limit, from, &s->in, REC_WORD, true) &&
+			     to_pointer(base, types, limit, from, &s->out, REC_WORD, true) &&
+			     to_pointer(base, types, limit, from, &s->err, REC_WORD, true) &&
+			     to_pointer(base, types, limit, from, &s->up, REC_COMMAND, false) &&
+			     s->verb != NULL;
+			break;
+		case REC_WORD:
+			word = (word_t *)(rec + 1);
+			ok = to_pointer(base, types, limit, from, &word->string, REC_STRING, true) &&
+			     to_pointer(base, types, limit, from, &word->next_part, REC_WORD, true) &&
+			     to_pointer(base, types, limit, from, &word->next_word, REC_WORD, true);
+			break;
+		}
+	}
+
+	lines = (struct scache_line *)(base + h->lines);
+	for (i = 0; ok && i < h->nlines; i++) {
+		off = lines[i].offset;
+		if (lines[i].kind == SCRIPT_LINE_COMMAND)
+			ok = off < limit && off % 8 == 0 && types[off / 8] == REC_COMMAND &&
+			     ((command_t *)(base + off))->up == NULL;
+		else if (lines[i].kind == SCRIPT_LINE_ERROR)
+			ok = off < limit && off % 8 == 0 && types[off / 8] == REC_STRING;
+		else
+			ok = lines[i].kind == SCRIPT_LINE_EMPTY;
+	}
+
+	free(types);
+	return ok;
+}
+
+static struct script *attach(char *base, size_t size, bool mapped)
+{
+	struct scache_header *h = (struct scache_header *)base;
+	struct script *s;
+
+	if (!relocate(base, size))
+		return NULL;
+
+	s = malloc(sizeof(*s));
+	DIE(s == NULL, "malloc");
+	s->base = base;
+	s->size = size;
+	s->mapped = mapped;
+	s->lines = (struct scache_line *)(base + h->lines);
+	s->nlines = h->nlines;
+
+	return s;
+}
+
+static bool header_matches(const struct scache_header *h, size_t size,
+			   const char *path, const struct stat *st,
+			   const uint64_t *hash)
+{
+	if (size < sizeof(*h) || memcmp(h->magic, SCACHE_MAGIC, sizeof(h->magic)) != 0)
+		return false;
+	if (h->version != SCACHE_VERSION || h->layout != SCACHE_LAYOUT || h->size != size)
+		return false;
+	if (h->path == 0 || h->path >= size || strncmp((const char *)h + h->path, path, size - h->path) != 0)
+		return false;
+	if (h->script_size != (uint64_t)st->st_size)
+		return false;
+
+	/* Without the content hash, only trust an unchanged mtime. */
+	if (hash == NULL)
+		return h->mtime_sec == st->st_mtim.tv_sec && h->mtime_nsec == st->st_mtim.tv_nsec;
+
+	return h->hash == *hash;
+}
+
+/**
+ * Map a cache file if it was compiled from this version of the script.
+ */
+static struct script *load(const char *cache_path, const char *path,
+			   const struct stat *st, const uint64_t *hash)
+{
+	struct scache_header *h;
+	struct script *s;
+	struct stat cst;
+	char *base;
+	int fd;
+
+	fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &cst) == -1 || (size_t)cst.st_size < sizeof(*h)) {
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	h = (struct scache_header *)base;
+	s = NULL;
+	if (header_matches(h, cst.st_size, path, st, hash))
+		s = attach(base, cst.st_size, true);
+
+	if (s == NULL)
+		munmap(base, cst.st_size);
+
+	return s;
+}
+
+/**
+ * The script was touched but not modified: store its new mtime in the
+ * cache, so the next run can trust it without hashing the script again.
+ */
+static void update_mtime(const char *cache_path, const struct stat *st)
+{
+	int64_t mtime[2] = { st->st_mtim.tv_sec, st->st_mtim.tv_nsec };
+	int fd;
+
+	fd = open(cache_path, O_WRONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	/* mtime_nsec follows mtime_sec; a failed write only costs a hash. */
+	(void)pwrite(fd, mtime, sizeof(mtime), offsetof(struct scache_header, mtime_sec));
+	close(fd);
+}
+
+static char *read_file(const char *path, size_t *size)
+{
+	char *content = NULL;
+	size_t len = 0, cap = 0;
+	ssize_t rc;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	for (;;) {
+		if (len + 1 >= cap) {
+			cap = cap ? 2 * cap : 64 * 1024;
+			content = realloc(content, cap);
+			DIE(content == NULL, "realloc");
+		}
+
+		rc = read(fd, content + len, cap - len - 1);
+		if (rc <= 0)
+			break;
+		len += rc;
+	}
+	close(fd);
+
+	if (rc < 0) {
+		free(content);
+		return NULL;
+	}
+
+	content[len] = '\0';
+	*size = len;
+
+	return content;
+}
+
+/**
+ * Parse every line of the script and serialize the trees. Parse errors
+ * are not reported here, the line is parsed again when it is reached.
+ */
+static void compile(struct writer *w, char *content, size_t size)
+{
+	struct scache_line *lines = NULL;
+	size_t nlines = 0, cap = 0, len;
+	char *line = content, *end;
+	command_t *root;
+	bool ok;
+
+	while (line < content + size) {
+		end = strchr(line, '\n');
+		if (end == NULL)
+			end = content + size;
+		len = end - line;
+		*end = '\0';
+		if (len > 0 && line[len - 1] == '\r')
+			line[--len] = '\0';
+
+		if (nlines == cap) {
+			cap = cap ? 2 * cap : 256;
+			lines = realloc(lines, cap * sizeof(*lines));
+			DIE(lines == NULL, "realloc");
+		}
+
+		root = NULL;
+		parse_errors_muted = true;
+		ok = stats_parse_line(line, &root);
+		parse_errors_muted = false;
+
+		memset(&lines[nlines], 0, sizeof(*lines));
+		if (!ok) {
+			lines[nlines].kind = SCRIPT_LINE_ERROR;
+			lines[nlines].offset = append(w, REC_STRING, line, len + 1);
+		} else if (root != NULL) {
+			lines[nlines].kind = SCRIPT_LINE_COMMAND;
+			lines[nlines].offset = write_tree(w, root);
+		}
+		free_parse_memory();
+
+		nlines++;
+		line = end + 1;
+	}
+
+	/* The line table is not a record, keep it out of the relocation. */
+	((struct scache_header *)w->buf)->nlines = nlines;
+	((struct scache_header *)w->buf)->lines = w->len;
+
+	if (w->len + nlines * sizeof(*lines) > w->cap) {
+		w->cap = w->len + nlines * sizeof(*lines);
+		w->buf = realloc(w->buf, w->cap);
+		DIE(w->buf == NULL, "realloc");
+	}
+	if (nlines > 0)
+		memcpy(w->buf + w->len, lines, nlines * sizeof(*lines));
+	w->len += nlines * sizeof(*lines);
+
+	free(lines);
+}
+
+static char *cache_dir(void)
+{
+	const char *dir = getenv("MINISHELL_CACHE_DIR");
+	const char *base;
+	char *path;
+
+	if (dir != NULL) {
+		if (*dir == '\0')
+			return NULL;
+		path = strdup(dir);
+		DIE(path == NULL, "strdup");
+		return path;
+	}
+
+	base = getenv("XDG_CACHE_HOME");
+	if (base != NULL && *base != '\0') {
+		if (asprintf(&path, "%s/mini-shell", base) == -1)
+			return NULL;
+		return path;
+	}
+
+	base = getenv("HOME");
+	if (base == NULL || *base == '\0')
+		return NULL;
+	if (asprintf(&path, "%s/.cache/mini-shell", base) == -1)
+		return NULL;
+
+	return path;
+}
+
+/**
+ * Create the directories of a path, like mkdir -p.
+ */
+static bool make_dirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p != '\0'; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static void store(const char *cache_path, const char *dir, struct writer *w)
+{
+	char *tmp;
+	size_t off;
+	ssize_t rc;
+	int fd;
+
+	if (asprintf(&tmp, "%s/.tmp.%d", dir, getpid()) == -1)
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		free(tmp);
+		return;
+	}
+
+	for (off = 0; off < w->len; off += rc) {
+		rc = write(fd, w->buf + off, w->len - off);
+		if (rc <= 0)
+			break;
+	}
+
+	/* Readers only ever see a complete file. */
+	if (close(fd) == 0 && off == w->len)
+		rename(tmp, cache_path);
+	else
+		unlink(tmp);
+
+	free(tmp);
+}
+
+struct script *scache_open(const char *path)
+{
+	struct writer w = { 0 };
+	struct scache_header h = { 0 };
+	char *dir, *real, *cache_path = NULL, *content;
+	struct script *s = NULL;
+	struct stat st;
+	uint64_t hash, off;
+	size_t size;
+
+	dir = cache_dir();
+	if (dir == NULL)
+		return NULL;
+
+	real = realpath(path, NULL);
+	if (real == NULL || stat(real, &st) == -1)
+		goto out;
+
+	if (asprintf(&cache_path, "%s/%016llx" SCACHE_SUFFIX, dir,
+		     (unsigned long long)hash_bytes(real, strlen(real), HASH_INIT)) == -1) {
+		cache_path = NULL;
+		goto out;
+	}
+
+	s = load(cache_path, real, &st, NULL);
+	if (s != NULL)
+		goto out;
+
+	content = read_file(real, &size);
+	if (content == NULL)
+		goto out;
+	hash = hash_bytes(content, size, HASH_INIT);
+
+	/* Touched but not modified. */
+	s = load(cache_path, real, &st, &hash);
+	if (s != NULL) {
+		update_mtime(cache_path, &st);
+		free(content);
+		goto out;
+	}
+
+	memcpy(h.magic, SCACHE_MAGIC, sizeof(h.magic));
+	h.version = SCACHE_VERSION;
+	h.layout = SCACHE_LAYOUT;
+	h.script_size = st.st_size;
+	h.mtime_sec = st.st_mtim.tv_sec;
+	h.mtime_nsec = st.st_mtim.tv_nsec;
+	h.hash = hash;
+
+	w.cap = 64 * 1024;
+	w.buf = malloc(w.cap);
+	DIE(w.buf == NULL, "malloc");
+	memcpy(w.buf, &h, sizeof(h));
+	w.len = ALIGN8(sizeof(h));
+
+	off = append(&w, REC_STRING, real, strlen(real) + 1);
+	((struct scache_header *)w.buf)->path = off;
+	compile(&w, content, size);
+	((struct scache_header *)w.buf)->size = w.len;
+	free(content);
+
+	if (make_dirs(dir))
+		store(cache_path, dir, &w);
+
+	s = attach(w.buf, w.len, false);
+	DIE(s == NULL, "script cache: bad compiled script");
+
+	free(w.map.keys);
+	free(w.map.values);
+	free(w.stack.items);
+	free(w.order.items);
+out:
+	free(cache_path);
+	free(real);
+	free(dir);
+
+	return s;
+}
+
+size_t scache_lines(struct script *s)
+{
+	return s->nlines;
+}
+
+int scache_line(struct script *s, size_t index, command_t **root,
+		const char **text)
+{
+	struct scache_line *line = &s->lines[index];
+
+	if (line->kind == SCRIPT_LINE_COMMAND)
+		*root = (command_t *)(s->base + line->offset);
+	else if (line->kind == SCRIPT_LINE_ERROR)
+		*text = s->base + line->offset;
+
+	return line->kind;
+}
+
+void scache_close(struct script *s)
+{
+	if (s->mapped)
+		munmap(s->base, s->size);
+	else
+		free(s->base);
+	free(s);
+}
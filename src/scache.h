@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SCACHE_H
+#define _SCACHE_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Compiled script cache.
+ *
+ * The parse trees of all the lines of a script are stored in a cache
+ * file, with pointers replaced by offsets from the start of the file.
+ * Loading maps the file and turns the offsets back into pointers, so
+ * the lines run without being lexed or parsed again.
+ *
+ * The cache lives in $MINISHELL_CACHE_DIR, or mini-shell/ under
+ * $XDG_CACHE_HOME (default ~/.cache). Setting MINISHELL_CACHE_DIR to an
+ * empty string disables it.
+ */
+
+#define SCRIPT_LINE_EMPTY	0
+#define SCRIPT_LINE_COMMAND	1
+#define SCRIPT_LINE_ERROR	2
+
+struct script;
+
+/**
+ * Load the compiled form of a script, compiling it and updating the
+ * cache if the script changed. Returns NULL if the script cannot be
+ * read or the cache is disabled.
+ */
+struct script *scache_open(const char *path);
+
+/**
+ * Number of lines of the script.
+ */
+size_t scache_lines(struct script *s);
+
+/**
+ * Get a line of the script: SCRIPT_LINE_COMMAND sets `root` to its parse
+ * tree, SCRIPT_LINE_ERROR sets `text` to the line, which failed to parse.
+ */
+int scache_line(struct script *s, size_t index, command_t **root,
+		const char **text);
+
+void scache_close(struct script *s);
+
+#endif /* _SCACHE_H */
@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <unistd.h>
+
+#include "../util/parser/parser.h"
+#include "server.h"
+#include "stats.h"
+#include "cmd.h"
+#include "utils.h"
+#include "optimize.h"
+
+#define SERVER_BACKLOG		128
+#define SERVER_FDS		3
+
+/* Connection of the current worker, for the reply sent at exit. */
+static int worker_conn = -1;
+static pid_t worker_pid;
+
+static void reap_workers(int signum)
+{
+	int saved_errno = errno;
+
+	(void)signum;
+
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+
+	errno = saved_errno;
+}
+
+static void send_status(int conn, int status)
+{
+	struct server_reply reply = { status };
+
+	send(conn, &reply, sizeof(reply), MSG_NOSIGNAL);
+}
+
+/**
+ * Builtins such as exit end the worker without returning to it: reply
+ * from the exit handler then. Children forked by the command inherit the
+ * handler, hence the pid check.
+ */
+static void reply_at_exit(void)
+{
+	if (worker_conn < 0 || getpid() != worker_pid)
+		return;
+
+	fflush(NULL);
+	send_status(worker_conn, 0);
+}
+
+static ssize_t recv_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t rc;
+
+	while (done < len) {
+		rc = recv(fd, (char *)buf + done, len - done, 0);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		done += rc;
+	}
+
+	return done;
+}
+
+static ssize_t send_full(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t rc;
+
+	while (done < len) {
+		rc = send(fd, (const char *)buf + done, len - done, MSG_NOSIGNAL);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -1;
+		done += rc;
+	}
+
+	return done;
+}
+
+/**
+ * Receive the request header together with the client's standard
+ * descriptors.
+ */
+static int recv_request(int conn, struct server_request *req, int fds[])
+{
+	char control[CMSG_SPACE(SERVER_FDS * sizeof(int))];
+	struct iovec iov = { req, sizeof(*req) };
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	ssize_t rc;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	do {
+		rc = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+	if (rc <= 0)
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(SERVER_FDS * sizeof(int)))
+		return -1;
+	memcpy(fds, CMSG_DATA(cmsg), SERVER_FDS * sizeof(int));
+
+	if ((size_t)rc < sizeof(*req) &&
+	    recv_full(conn, (char *)req + rc, sizeof(*req) - rc) < 0)
+		return -1;
+
+	return req->magic == SERVER_MAGIC ? 0 : -1;
+}
+
+/**
+ * Serve one connection: read the command line, take over the client's
+ * standard descriptors and run it.
+ */
+static void run_worker(int conn)
+{
+	struct server_request req;
+	command_t *root = NULL;
+	int fds[SERVER_FDS], i, ret = 0;
+	char *line;
+
+	if (recv_request(conn, &req, fds) < 0)
+		exit(EXIT_FAILURE);
+
+	/* A command line longer than exec accepts can only be garbage. */
+	if (req.length > sysconf(_SC_ARG_MAX)) {
+		send_status(conn, EXIT_FAILURE);
+		exit(EXIT_FAILURE);
+	}
+
+	line = malloc(req.length + 1);
+	DIE(line == NULL, "malloc");
+	if (recv_full(conn, line, req.length) < 0)
+		exit(EXIT_FAILURE);
+	line[req.length] = '\0';
+
+	for (i = 0; i < SERVER_FDS; i++) {
+		DIE(dup2(fds[i], i) < 0, "dup2");
+		close(fds[i]);
+	}
+
+	worker_conn = conn;
+	worker_pid = getpid();
+	atexit(reply_at_exit);
+
+	stats_parse_line(line, &root);
+	root = optimize_command(root);
+	if (root != NULL)
+		ret = parse_command(root, 0, NULL);
+	else
+		ret = EXIT_FAILURE;
+
+	fflush(NULL);
+	worker_conn = -1;
+	send_status(conn, ret == SHELL_EXIT ? 0 : ret);
+	exit(EXIT_SUCCESS);
+}
+
+static bool socket_address(const char *path, struct sockaddr_un *addr)
+{
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return false;
+	}
+
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static int server_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t mask;
+	int fd, rc;
+
+	if (!socket_address(path, &addr))
+		return -1;
+
+	/* Only a socket left by an earlier server is replaced. */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "%s: exists and is not a socket\n", path);
+			return -1;
+		}
+		if (unlink(path) < 0) {
+			perror(path);
+			return -1;
+		}
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	DIE(fd < 0, "socket");
+
+	/* Whoever can connect runs commands as us: the socket is ours only. */
+	mask = umask(077);
+	rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+
+	if (rc < 0 || listen(fd, SERVER_BACKLOG) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Serve only the user running the server, should the socket be reachable
+ * by others despite its mode.
+ */
+static bool is_own_peer(int conn)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+	       cred.uid == getuid();
+}
+
+int server_run(const char *path)
+{
+	struct sigaction sa = { 0 };
+	command_t *root = NULL;
+	int fd, conn;
+	pid_t pid;
+
+	fd = server_listen(path);
+	if (fd < 0)
+		return -1;
+
+	sa.sa_handler = reap_workers;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	DIE(sigaction(SIGCHLD, &sa, NULL) < 0, "sigaction");
+
+	/* Warm up the parser, so workers start from an initialized one. */
+	parse_line("true", &root);
+	free_parse_memory();
+
+	for (;;) {
+		conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			close(fd);
+			return -1;
+		}
+
+		if (!is_own_peer(conn)) {
+			fprintf(stderr, "%s: refused a client of another user\n", path);
+			close(conn);
+			continue;
+		}
+
+		pid = stats_fork();
+		if (pid == 0) {
+			close(fd);
+			signal(SIGCHLD, SIG_DFL);
+			run_worker(conn);
+		}
+		if (pid < 0)
+			perror("fork");
+
+		close(conn);
+	}
+}
+
+int server_send(const char *path, const char *line)
+{
+	struct server_request req = { SERVER_MAGIC, strlen(line) };
+	char control[CMSG_SPACE(SERVER_FDS * sizeof(int))] = { 0 };
+	int fds[SERVER_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	struct iovec iov = { &req, sizeof(req) };
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct server_reply reply;
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	ssize_t rc;
+	int fd;
+
+	if (!socket_address(path, &addr))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	DIE(fd < 0, "socket");
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	do {
+		rc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+
+	/* The descriptors went with the first bytes, the rest is plain data. */
+	if (rc < 0 ||
+	    send_full(fd, (char *)&req + rc, sizeof(req) - rc) < 0 ||
+	    send_full(fd, line, req.length) < 0 ||
+	    recv_full(fd, &reply, sizeof(reply)) < 0) {
+		fprintf(stderr, "%s: no reply from the server\n", path);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	return reply.status;
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdint.h>
+
+/**
+ * Server mode: a warm shell accepts command lines on a Unix domain
+ * stream socket and runs each one in a forked worker.
+ *
+ * Protocol, one request per connection:
+ *   - the client sends a struct server_request, with its stdin, stdout
+ *     and stderr descriptors attached in that order (SCM_RIGHTS);
+ *   - then `length` bytes of command line (no NUL terminator);
+ *   - the server replies with a struct server_reply once the command
+ *     finished and closes the connection.
+ */
+
+#define SERVER_MAGIC		0x4d534831	/* "MSH1" */
+
+struct server_request {
+	uint32_t magic;
+	uint32_t length;
+};
+
+struct server_reply {
+	int32_t status;
+};
+
+/**
+ * Listen on `path` and serve requests forever. Returns only on error.
+ */
+int server_run(const char *path);
+
+/**
+ * Run `line` on the server listening on `path`, with the standard
+ * descriptors of the caller. Returns the exit status of the command, -1
+ * if the server could not be reached.
+ */
+int server_send(const char *path, const char *line);
+
+#endif /* _SERVER_H */
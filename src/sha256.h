@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * SHA-256 (FIPS 180-4), for the keys of the memo cache, which must not
+ * collide the way a plain hash can.
+ */
+
+#define SHA256_LEN		32
+
+struct sha256 {
+	uint32_t state[8];
+	uint64_t len;		/* bytes hashed so far */
+	unsigned char block[64];
+	size_t used;		/* bytes waiting in block */
+};
+
+void sha256_init(struct sha256 *h);
+
+void sha256_update(struct sha256 *h, const void *buf, size_t len);
+
+/**
+ * Store the digest of everything hashed in `digest`.
+ */
+void sha256_final(struct sha256 *h, unsigned char digest[SHA256_LEN]);
+
+#endif /* _SHA256_H */
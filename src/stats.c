@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <unistd.h>
+
+#include "stats.h"
+#include "profile.h"
+#include "utils.h"
+
+#define STATS_VAR		"MINISHELL_STATS_FILE"
+
+#define SUB_BITS		4
+#define SUB_BUCKETS		(1 << SUB_BITS)
+/* Values below SUB_BUCKETS get a bucket each, then 16 per power of two. */
+#define NR_BUCKETS		((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+#define NSEC_PER_SEC		1000000000.0
+#define NSEC_PER_MSEC		1000000.0
+
+struct histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[NR_BUCKETS];
+};
+
+struct stats {
+	uint64_t counters[STATS_NR_COUNTERS];
+	struct histogram histograms[STATS_NR_HISTOGRAMS];
+};
+
+static const struct {
+	const char *name;
+	const char *metric;
+	const char *help;
+	bool time;
+} counter_info[STATS_NR_COUNTERS] = {
+	[STATS_LINES] = { "lines parsed", "minishell_lines_parsed_total",
+			  "Command lines parsed.", false },
+	[STATS_PARSE_NS] = { "parse time", "minishell_parse_seconds_total",
+			     "Time spent parsing command lines.", true },
+	[STATS_FORKS] = { "forks", "minishell_forks_total",
+			  "Processes forked.", false },
+	[STATS_EXECS] = { "execs", "minishell_execs_total",
+			  "Programs executed, failures included.", false },
+	[STATS_EXEC_FAILURES] = { "exec failures",
+				  "minishell_exec_failures_total",
+				  "Programs that could not be executed.", false },
+	[STATS_BUILTINS] = { "builtin calls", "minishell_builtin_calls_total",
+			     "Internal commands run.", false },
+	[STATS_WAIT_NS] = { "wait time", "minishell_wait_seconds_total",
+			    "Time spent waiting for children.", true },
+	[STATS_MEMO_HITS] = { "memo hits", "minishell_memo_hits_total",
+			      "Memoized commands replayed from the cache.", false },
+	[STATS_MEMO_MISSES] = { "memo misses", "minishell_memo_misses_total",
+				"Memoized commands run and stored.", false },
+	[STATS_MEMO_EVICTIONS] = { "memo evictions",
+				   "minishell_memo_evictions_total",
+				   "Cache entries removed to stay within size.",
+				   false },
+};
+
+static const struct {
+	const char *name;
+	const char *metric;
+	const char *help;
+} histogram_info[STATS_NR_HISTOGRAMS] = {
+	[STATS_COMMAND_NS] = { "command wall time",
+			       "minishell_command_duration_seconds",
+			       "Wall time of simple commands." },
+	[STATS_FORK_EXEC_NS] = { "fork to exec", "minishell_fork_exec_seconds",
+				 "Time from fork to exec in the child." },
+};
+
+/* Used until stats_init() maps the shared counters. */
+static struct stats local_stats;
+static struct stats *stats = &local_stats;
+
+/* The process that dumps the counters at exit. */
+static pid_t owner;
+/* When the last stats_fork() happened, inherited by the child. */
+static uint64_t fork_time;
+
+static size_t bucket_index(uint64_t value)
+{
+	int exponent;
+
+	if (value < SUB_BUCKETS)
+		return value;
+
+	exponent = 63 - __builtin_clzll(value);
+	return (exponent - SUB_BITS + 1) * SUB_BUCKETS +
+	       ((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* Smallest value that goes in the bucket. */
+static uint64_t bucket_lower(size_t i)
+{
+	int exponent;
+
+	if (i < SUB_BUCKETS)
+		return i;
+
+	exponent = i / SUB_BUCKETS + SUB_BITS - 1;
+	return (uint64_t)(SUB_BUCKETS + i % SUB_BUCKETS) << (exponent - SUB_BITS);
+}
+
+/* Largest value that goes in the bucket. */
+static uint64_t bucket_upper(size_t i)
+{
+	return i + 1 < NR_BUCKETS ? bucket_lower(i + 1) - 1 : UINT64_MAX;
+}
+
+/**
+ * Smallest bucket bound under which a fraction `q` of the values are.
+ */
+static uint64_t percentile(const struct histogram *h, double q)
+{
+	double wanted = q * h->count;
+	uint64_t target = wanted, seen = 0;
+	size_t i;
+
+	if (target < wanted || target == 0)
+		target++;
+
+	for (i = 0; i < NR_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target)
+			return bucket_upper(i) < h->max ? bucket_upper(i) : h->max;
+	}
+
+	return h->max;
+}
+
+static void write_prometheus(FILE *file)
+{
+	const struct histogram *h;
+	uint64_t value, seen;
+	size_t i, j;
+
+	for (i = 0; i < STATS_NR_COUNTERS; i++) {
+		value = stats->counters[i];
+		fprintf(file, "# HELP %s %s\n", counter_info[i].metric,
+			counter_info[i].help);
+		fprintf(file, "# TYPE %s counter\n", counter_info[i].metric);
+		if (counter_info[i].time)
+			fprintf(file, "%s %.9f\n", counter_info[i].metric,
+				value / NSEC_PER_SEC);
+		else
+			fprintf(file, "%s %" PRIu64 "\n", counter_info[i].metric,
+				value);
+	}
+
+	/*
+	 * Every bucket is listed, hit or not, so that the boundaries are the
+	 * same in every dump; the last one is +Inf.
+	 */
+	for (i = 0; i < STATS_NR_HISTOGRAMS; i++) {
+		h = &stats->histograms[i];
+		fprintf(file, "# HELP %s %s\n", histogram_info[i].metric,
+			histogram_info[i].help);
+		fprintf(file, "# TYPE %s histogram\n", histogram_info[i].metric);
+
+		seen = 0;
+		for (j = 0; j + 1 < NR_BUCKETS; j++) {
+			seen += h->buckets[j];
+			fprintf(file, "%s_bucket{le=\"%.9g\"} %" PRIu64 "\n",
+				histogram_info[i].metric,
+				bucket_upper(j) / NSEC_PER_SEC, seen);
+		}
+		fprintf(file, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+			histogram_info[i].metric, h->count);
+		fprintf(file, "%s_sum %.9f\n", histogram_info[i].metric,
+			h->sum / NSEC_PER_SEC);
+		fprintf(file, "%s_count %" PRIu64 "\n", histogram_info[i].metric,
+			h->count);
+	}
+}
+
+static void dump_at_exit(void)
+{
+	const char *path = getenv(STATS_VAR);
+	FILE *file;
+
+	/* Subshells exit too, only the shell itself writes the file. */
+	if (getpid() != owner || path == NULL || *path == '\0')
+		return;
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		return;
+	}
+
+	write_prometheus(file);
+	fclose(file);
+}
+
+void stats_init(void)
+{
+	struct stats *shared;
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	DIE(shared == MAP_FAILED, "mmap");
+
+	memcpy(shared, stats, sizeof(*shared));
+	stats = shared;
+
+	owner = getpid();
+	atexit(dump_at_exit);
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_add(enum stats_counter counter, uint64_t value)
+{
+	__atomic_fetch_add(&stats->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_get(enum stats_counter counter)
+{
+	return __atomic_load_n(&stats->counters[counter], __ATOMIC_RELAXED);
+}
+
+void stats_record(enum stats_histogram histogram, uint64_t value)
+{
+	struct histogram *h = &stats->histograms[histogram];
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->buckets[bucket_index(value)], 1, __ATOMIC_RELAXED);
+
+	while (value > max &&
+	       !__atomic_compare_exchange_n(&h->max, &max, value, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+bool stats_parse_line(const char *line, command_t **root)
+{
+	uint64_t start = stats_now();
+	bool ok = parse_line(line, root);
+
+	stats_add(STATS_LINES, 1);
+	stats_add(STATS_PARSE_NS, stats_now() - start);
+
+	return ok;
+}
+
+pid_t stats_fork(void)
+{
+	pid_t pid;
+
+	fork_time = stats_now();
+	pid = fork();
+	if (pid > 0) {
+		stats_add(STATS_FORKS, 1);
+		profile_fork(stats_now() - fork_time);
+	}
+
+	return pid;
+}
+
+void stats_exec(void)
+{
+	stats_add(STATS_EXECS, 1);
+	stats_record(STATS_FORK_EXEC_NS, stats_now() - fork_time);
+}
+
+pid_t stats_waitpid(pid_t pid, int *status, int options)
+{
+	uint64_t start = stats_now();
+	struct rusage usage;
+
+	pid = wait4(pid, status, options, &usage);
+	stats_add(STATS_WAIT_NS, stats_now() - start);
+	if (pid > 0)
+		profile_child(&usage);
+
+	return pid;
+}
+
+void stats_print(FILE *file)
+{
+	const struct histogram *h;
+	uint64_t value;
+	size_t i;
+
+	for (i = 0; i < STATS_NR_COUNTERS; i++) {
+		value = stats->counters[i];
+		if (counter_info[i].time)
+			fprintf(file, "%-20s%.3f ms\n", counter_info[i].name,
+				value / NSEC_PER_MSEC);
+		else
+			fprintf(file, "%-20s%" PRIu64 "\n", counter_info[i].name,
+				value);
+	}
+
+	for (i = 0; i < STATS_NR_HISTOGRAMS; i++) {
+		h = &stats->histograms[i];
+		fprintf(file, "%-20s%" PRIu64, histogram_info[i].name, h->count);
+		if (h->count > 0)
+			fprintf(file,
+				", mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms",
+				h->sum / NSEC_PER_MSEC / h->count,
+				percentile(h, 0.50) / NSEC_PER_MSEC,
+				percentile(h, 0.90) / NSEC_PER_MSEC,
+				percentile(h, 0.99) / NSEC_PER_MSEC,
+				h->max / NSEC_PER_MSEC);
+		fputc('\n', file);
+	}
+}
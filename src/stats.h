@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Runtime counters and latency histograms of the shell.
+ *
+ * The counters live in a shared anonymous mapping created by stats_init()
+ * before any fork, so the subshells of pipes, parallel commands and the
+ * parallel builtin add to the same totals. They are printed by the stats
+ * internal command and, if MINISHELL_STATS_FILE names a file, written
+ * there in the Prometheus text format when the shell exits.
+ *
+ * Histograms are log-linear like HDR histograms: 16 buckets per power of
+ * two, so any recorded value is known within 6.25%.
+ */
+
+enum stats_counter {
+	STATS_LINES,		/* command lines parsed */
+	STATS_PARSE_NS,		/* time spent parsing them */
+	STATS_FORKS,
+	STATS_EXECS,		/* exec attempts */
+	STATS_EXEC_FAILURES,
+	STATS_BUILTINS,		/* internal commands run */
+	STATS_WAIT_NS,		/* time spent waiting for children */
+	STATS_MEMO_HITS,	/* memo commands replayed from the cache */
+	STATS_MEMO_MISSES,	/* memo commands run and stored */
+	STATS_MEMO_EVICTIONS,	/* cache entries removed to stay in size */
+	STATS_NR_COUNTERS
+};
+
+enum stats_histogram {
+	STATS_COMMAND_NS,	/* wall time of simple commands */
+	STATS_FORK_EXEC_NS,	/* from fork() to exec() in the child */
+	STATS_NR_HISTOGRAMS
+};
+
+/**
+ * Map the shared counters and register the dump at exit. Call once, in
+ * the main shell process, before forking.
+ */
+void stats_init(void);
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+uint64_t stats_now(void);
+
+void stats_add(enum stats_counter counter, uint64_t value);
+
+uint64_t stats_get(enum stats_counter counter);
+
+void stats_record(enum stats_histogram histogram, uint64_t value);
+
+/**
+ * parse_line() that counts the line and the time spent parsing it.
+ */
+bool stats_parse_line(const char *line, command_t **root);
+
+/**
+ * fork() that counts the fork and remembers when it happened, for
+ * stats_exec() in the child.
+ */
+pid_t stats_fork(void);
+
+/**
+ * Count an exec attempt; call in the child right before exec().
+ */
+void stats_exec(void);
+
+/**
+ * waitpid() that adds the time it blocks to the wait time, and the
+ * resources of the child to the profile.
+ */
+pid_t stats_waitpid(pid_t pid, int *status, int options);
+
+/**
+ * Print the counters and a summary of the histograms.
+ */
+void stats_print(FILE *file);
+
+#endif /* _STATS_H */
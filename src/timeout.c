@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "timeout.h"
+#include "stats.h"
+#include "profile.h"
+#include "utils.h"
+
+/* How often to check on the child when pidfd_open() is missing. */
+#define POLL_INTERVAL_MS	10
+
+#define SECONDS_PER_DAY		(24 * 60 * 60)
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	return -1;
+#endif
+}
+
+static void arm(int fd, const struct timespec *when)
+{
+	struct itimerspec its = { .it_value = *when };
+
+	DIE(timerfd_settime(fd, 0, &its, NULL) == -1, "timerfd_settime");
+}
+
+bool timeout_parse(const char *str, struct timespec *duration)
+{
+	double seconds;
+	char *end;
+
+	errno = 0;
+	seconds = strtod(str, &end);
+	if (end == str || errno != 0 || !(seconds >= 0))
+		return false;
+
+	switch (*end) {
+	case 'd':
+		seconds *= 24;
+		/* fall through */
+	case 'h':
+		seconds *= 60;
+		/* fall through */
+	case 'm':
+		seconds *= 60;
+		/* fall through */
+	case 's':
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		return false;
+
+	/* Deadlines past the range of time_t never expire. */
+	if (seconds >= (double)INT_MAX * SECONDS_PER_DAY) {
+		duration->tv_sec = 0;
+		duration->tv_nsec = 0;
+		return true;
+	}
+
+	duration->tv_sec = seconds;
+	duration->tv_nsec = (seconds - duration->tv_sec) * 1000000000;
+	/* Round up, so that a tiny duration is not taken as no deadline. */
+	if (duration->tv_sec == 0 && duration->tv_nsec == 0 && seconds > 0)
+		duration->tv_nsec = 1;
+
+	return true;
+}
+
+bool timeout_wait(pid_t pid, const struct timespec *limit,
+		  const struct timespec *grace, int *status)
+{
+	uint64_t start = stats_now(), expirations;
+	struct rusage usage;
+	struct pollfd fds[2];
+	bool expired = false;
+	int ret;
+
+	fds[0].fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	DIE(fds[0].fd == -1, "timerfd_create");
+	fds[0].events = POLLIN;
+	arm(fds[0].fd, limit);
+
+	/* poll() skips a negative descriptor; the child is checked periodically. */
+	fds[1].fd = open_pidfd(pid);
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+
+	for (;;) {
+		ret = poll(fds, 2, fds[1].fd >= 0 ? -1 : POLL_INTERVAL_MS);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		DIE(ret == -1, "poll");
+
+		if ((fds[1].fd < 0 || fds[1].revents != 0) &&
+		    wait4(pid, status, WNOHANG, &usage) == pid) {
+			profile_child(&usage);
+			break;
+		}
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+		DIE(read(fds[0].fd, &expirations, sizeof(expirations)) == -1, "read");
+
+		if (!expired) {
+			expired = true;
+			kill(-pid, SIGTERM);
+			/* A stopped group could not handle SIGTERM. */
+			kill(-pid, SIGCONT);
+			if (grace->tv_sec != 0 || grace->tv_nsec != 0)
+				arm(fds[0].fd, grace);
+		} else {
+			kill(-pid, SIGKILL);
+		}
+	}
+
+	close(fds[0].fd);
+	if (fds[1].fd >= 0)
+		close(fds[1].fd);
+
+	stats_add(STATS_WAIT_NS, stats_now() - start);
+
+	return expired;
+}
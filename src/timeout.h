@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _TIMEOUT_H
+#define _TIMEOUT_H
+
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+
+/**
+ * Deadlines of the timeout internal command:
+ *   timeout [-k GRACE] DURATION COMMAND [ARG]...
+ *
+ * The external command runs in a process group of its own. If it is
+ * still running after DURATION, the group gets SIGTERM, then SIGKILL if
+ * it has not exited GRACE (default 2s) later, and the status is 124.
+ * Durations are numbers of seconds, fractions allowed, with an optional
+ * s, m, h or d suffix; a duration of 0 disables the deadline.
+ *
+ * Internal commands and assignments run without a deadline.
+ */
+
+#define TIMEOUT_EXPIRED		124
+#define TIMEOUT_USAGE		125
+
+#define TIMEOUT_GRACE		"2"
+
+/**
+ * Parse a duration. Returns false if `str` is not one.
+ */
+bool timeout_parse(const char *str, struct timespec *duration);
+
+/**
+ * Wait for the child `pid`, the leader of its process group, signaling
+ * the group when `limit` and then `grace` expire. Stores the status as
+ * waitpid() does and returns true if the deadline expired.
+ */
+bool timeout_wait(pid_t pid, const struct timespec *limit,
+		  const struct timespec *grace, int *status);
+
+#endif /* _TIMEOUT_H */
@@ -1,10 +1,44 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+
+#include <sys/sendfile.h>
+
+#include <unistd.h>
 
 #include "utils.h"
+#include "pathexp.h"
+#include "arith.h"
+
+/**
+ * Get the text of a word part, expanding variables and arithmetic; the
+ * result of an arithmetic expansion is written in `number`. A failed
+ * arithmetic expansion is reported and expands to the empty string.
+ */
+static const char *expand_part(word_t *part, char number[ARITH_BUFSIZ])
+{
+	const char *substring;
+	int64_t value;
+
+	if (part->arith) {
+		if (arith_eval(part->string, &value) < 0)
+			return "";
+		snprintf(number, ARITH_BUFSIZ, "%" PRId64, value);
+		return number;
+	}
+
+	if (!part->expand)
+		return part->string;
+
+	substring = getenv(part->string);
+
+	/* Prevents strlen from failing. */
+	return substring != NULL ? substring : "";
+}
 
 /**
  * Concatenate parts of the word to obtain the command.
@@ -16,25 +50,17 @@ char *get_word(word_t *s)
 
 	const char *substring = NULL;
 	int substring_length = 0;
+	char number[ARITH_BUFSIZ];
 
 	while (s != NULL) {
-		if (s->expand == true) {
-			substring = getenv(s->string);
-
-			/* Prevents strlen from failing. */
-			if (substring == NULL)
-				substring = "";
-		} else {
-			substring = s->string;
-		}
+		substring = expand_part(s, number);
 
 		substring_length = strlen(substring);
 
 		string = realloc(string, string_length + substring_length + 1);
 		DIE(string == NULL, "Error allocating word string.");
 
-		string[string_length] = '\0';
-		strcat(string, substring);
+		memcpy(string + string_length, substring, substring_length + 1);
 
 		string_length += substring_length;
 
@@ -44,27 +70,117 @@ char *get_word(word_t *s)
 	return string;
 }
 
+/**
+ * The parser keeps an unquoted '=' as a part of its own (name=value), so
+ * the assignment is recognized without expanding the word.
+ */
+bool is_assignment(word_t *verb)
+{
+	word_t *eq = verb->next_part;
+
+	return eq != NULL && !eq->expand && !eq->quoted && !eq->arith &&
+	       strcmp(eq->string, "=") == 0;
+}
+
+/**
+ * Concatenate parts of the word into a pathname expansion pattern; the
+ * wildcards coming from quoted parts are escaped. The word itself, as
+ * get_word() would return it, is stored in `word`: each part is expanded
+ * once, so that arithmetic side effects happen once. Returns NULL if no
+ * unquoted part contains wildcards.
+ */
+static char *get_pattern(word_t *s, char **word)
+{
+	char *pattern = NULL, *string = NULL;
+	int pattern_length = 0, string_length = 0, substring_length;
+	bool magic = false;
+	word_t *part;
+	const char *substring;
+	char number[ARITH_BUFSIZ];
+	int i;
+
+	for (part = s; part != NULL; part = part->next_part) {
+		substring = expand_part(part, number);
+		substring_length = strlen(substring);
+
+		/* Numbers never contain wildcards. */
+		if (!part->quoted && !part->arith && pathexp_has_magic(substring))
+			magic = true;
+
+		string = realloc(string, string_length + substring_length + 1);
+		DIE(string == NULL, "Error allocating word string.");
+		memcpy(string + string_length, substring, substring_length + 1);
+		string_length += substring_length;
+
+		/* Escaping can at most double the length. */
+		pattern = realloc(pattern, pattern_length + 2 * substring_length + 1);
+		DIE(pattern == NULL, "Error allocating pattern string.");
+
+		for (i = 0; substring[i] != '\0'; i++) {
+			if (part->quoted && strchr("\\*?[", substring[i]) != NULL)
+				pattern[pattern_length++] = '\\';
+			pattern[pattern_length++] = substring[i];
+		}
+		pattern[pattern_length] = '\0';
+	}
+
+	*word = string != NULL ? string : strdup("");
+	DIE(*word == NULL, "Error allocating word string.");
+
+	if (!magic) {
+		free(pattern);
+		return NULL;
+	}
+
+	return pattern;
+}
+
+bool is_literal(word_t *w, const char *str)
+{
+	return w->next_part == NULL && !w->expand && !w->arith &&
+	       strcmp(w->string, str) == 0;
+}
+
+const char *word_part_format(word_t *part)
+{
+	if (part->arith)
+		return part->quoted ? "\"$((%s))\"" : "$((%s))";
+	if (part->expand)
+		return part->quoted ? "\"$%s\"" : "$%s";
+
+	return part->quoted ? "'%s'" : "%s";
+}
+
+void print_word(FILE *f, word_t *w)
+{
+	for (; w != NULL; w = w->next_part)
+		fprintf(f, word_part_format(w), w->string);
+}
+
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
- * them directly to execv.
+ * them directly to execv. Unquoted wildcards are expanded to the sorted
+ * list of matching paths.
  */
 char **get_argv(simple_command_t *command, int *size)
 {
 	char **argv;
-	int argc;
+	int argc, argv_size;
 
 	word_t *param;
+	char *pattern, *word, **matches;
+	size_t nmatches, i;
 
-	argc = 1;
+	argv_size = 1;
 
 	/* Get parameters number. */
 	param = command->params;
 	while (param != NULL) {
 		param = param->next_word;
-		argc++;
+		argv_size++;
 	}
 
-	argv = calloc(argc + 1, sizeof(char *));
+	argv = calloc(argv_size + 1, sizeof(char *));
 	DIE(argv == NULL, "Error allocating argv.");
 
 	argv[0] = get_word(command->verb);
@@ -73,14 +189,114 @@ char **get_argv(simple_command_t *command, int *size)
 	param = command->params;
 	argc = 1;
 	while (param != NULL) {
-		argv[argc] = get_word(param);
-		DIE(argv[argc] == NULL, "Error retrieving word.");
+		pattern = get_pattern(param, &word);
+		nmatches = pattern ? pathexp_expand(pattern, &matches) : 0;
+		free(pattern);
+
+		if (nmatches == 0) {
+			argv[argc++] = word;
+		} else {
+			free(word);
+			argv_size += nmatches - 1;
+			argv = realloc(argv, (argv_size + 1) * sizeof(char *));
+			DIE(argv == NULL, "Error allocating argv.");
+
+			for (i = 0; i < nmatches; i++)
+				argv[argc++] = matches[i];
+			free(matches);
+		}
 
 		param = param->next_word;
-		argc++;
 	}
+	argv[argc] = NULL;
 
 	*size = argc;
 
 	return argv;
 }
+
+/**
+ * 64-bit FNV-1a hash of a buffer.
+ */
+uint64_t hash_bytes(const void *buf, size_t len, uint64_t hash)
+{
+	const unsigned char *p = buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t parse_size(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	errno = 0;
+	size = strtoull(str, &end, 10);
+	if (errno != 0 || end == str)
+		return 0;
+
+	switch (*end) {
+	case 'G':
+		size <<= 10;
+		/* fall through */
+	case 'M':
+		size <<= 10;
+		/* fall through */
+	case 'K':
+		size <<= 10;
+		end++;
+		break;
+	}
+
+	return *end == '\0' ? size : 0;
+}
+
+/**
+ * Copy with read() and write(), for the outputs sendfile() does not
+ * support.
+ */
+static void copy_user(int from, off_t off, off_t end, int to)
+{
+	char buf[COPY_BLOCK];
+	ssize_t n, done, rc;
+
+	while (off < end) {
+		n = pread(from, buf, end - off < COPY_BLOCK ? end - off : COPY_BLOCK,
+			  off);
+		if (n <= 0)
+			return;
+		off += n;
+
+		for (done = 0; done < n; done += rc) {
+			rc = write(to, buf + done, n - done);
+			if (rc < 0 && errno == EINTR)
+				rc = 0;
+			else if (rc < 0)
+				return;
+		}
+	}
+}
+
+void copy_range(int from, off_t off, off_t end, int to)
+{
+	ssize_t rc;
+
+	while (off < end) {
+		rc = sendfile(to, from, &off, end - off);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0 && errno == EINVAL) {
+			copy_user(from, off, end, to);
+			return;
+		}
+		/* The reader went away, like a write would fail. */
+		if (rc <= 0)
+			return;
+	}
+}
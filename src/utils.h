@@ -3,11 +3,20 @@
 #ifndef _UTILS_H
 #define _UTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+
 #include "../util/parser/parser.h"
 
 #define PIPE_READ	0
 #define PIPE_WRITE	1
 
+/* Buffer size of the copies that go through user space. */
+#define COPY_BLOCK	(64 * 1024)
+
 /* Useful macro for handling error codes. */
 #define DIE(assertion, call_description)			\
 	do {							\
@@ -19,15 +28,60 @@
 		}						\
 	} while (0)
 
+/* Set while parsing ahead of execution, when errors are not reported. */
+extern bool parse_errors_muted;
+
 /**
  * Concatenate parts of the word to obtain the command.
  */
 char *get_word(word_t *s);
 
+/**
+ * Tell if a command word is a variable assignment (name=value).
+ */
+bool is_assignment(word_t *verb);
+
+/**
+ * Tell if a word is `str` as a single part, with nothing to expand.
+ */
+bool is_literal(word_t *w, const char *str);
+
+/**
+ * The printf() format showing one part of a word the way it was written:
+ * variables and arithmetic are not expanded, quoted parts are quoted again.
+ */
+const char *word_part_format(word_t *part);
+
+/**
+ * Print all parts of a word the way it was written to `f`.
+ */
+void print_word(FILE *f, word_t *w);
+
 /**
  * Concatenate command arguments in a NULL terminated list in order to pass
  * them directly to execv.
  */
 char **get_argv(simple_command_t *command, int *size);
 
+/* Initial value for hash_bytes(). */
+#define HASH_INIT	0xcbf29ce484222325ULL
+
+/**
+ * 64-bit FNV-1a hash of a buffer; chain calls by passing the previous
+ * result as `hash`.
+ */
+uint64_t hash_bytes(const void *buf, size_t len, uint64_t hash);
+
+/**
+ * Parse a size in bytes with an optional K, M or G suffix; 0 if invalid.
+ */
+uint64_t parse_size(const char *str);
+
+/**
+ * Copy the bytes of the file `from` between `off` and `end` to `to`.
+ * sendfile() moves the pages inside the kernel; outputs it does not
+ * support get read() and write(). Stops early if `to` fails.
+ */
+void copy_range(int from, off_t off, off_t end, int to);
+
 #endif /* _UTILS_H */
@@ -27,8 +27,10 @@ static void displayWord(word_t * w)
 	while (crt != NULL) {
 		if (crt->expand)
 			std::cout << "expand(";
+		else if (crt->arith)
+			std::cout << "arith(";
 		std::cout << "'" << crt->string << "'";
-		if (crt->expand)
+		if (crt->expand || crt->arith)
 			std::cout << ")";
 
 		crt = crt->next_part;
@@ -111,6 +113,15 @@ static void displayCommand(command_t * c, int level, command_t * father)
 		std::cout << std::setw(2 * indent * level + indent) << "" << "scmd (" << std::endl;
 		displaySimple(c->scmd, level + 1, c);
 		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+	} else if (c->op == OP_FOR) {
+		assert(c->cmd2 == NULL);
+		std::cout << std::setw(2 * indent * level + indent) << "" << "op == OP_FOR" << std::endl;
+		std::cout << std::setw(2 * indent * level + indent) << "" << "scmd (" << std::endl;
+		displaySimple(c->scmd, level + 1, c);
+		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+		std::cout << std::setw(2 * indent * level + indent) << "" << "cmd1 (" << std::endl;
+		displayCommand(c->cmd1, level + 1, c);
+		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
 	} else {
 		assert(c->scmd == NULL);
 		std::cout << std::setw(2 * indent * level + indent) << "" << "op == ";
@@ -131,6 +142,9 @@ static void displayCommand(command_t * c, int level, command_t * father)
 		case OP_PIPE:
 			std::cout << "OP_PIPE";
 			break;
+		case OP_WHILE:
+			std::cout << "OP_WHILE";
+			break;
 		default:
 			assert(false);
 		}
@@ -0,0 +1,435 @@
+/*
+ * Hand-written lexer, producing the same tokens, values and locations as
+ * parser.l without going through the flex DFA: runs of word characters,
+ * quoted text and arithmetic expressions are found with SSE2 byte
+ * classification, 16 bytes at a time. Token values are copied into a
+ * single buffer allocated for the whole line instead of one strdup()
+ * per token.
+ *
+ * Each state below mirrors a start condition of parser.l; the comments
+ * name the flex rules that a branch stands for. The flex lexer is still
+ * used when MINISHELL_LEXER is set to "flex" (see parse_line()).
+ */
+
+#ifdef __cplusplus
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define __PARSER_H_INTERNAL_INCLUDE
+#include "parser.h"
+#include "parser.tab.h"
+
+
+enum {
+	LEX_INITIAL,
+	LEX_ACCEPT_ANY,			/* '...' */
+	LEX_ACCEPT_ANY_AND_EXPANSION,	/* "..." */
+	LEX_ARITHMETIC,			/* $((... */
+	LEX_ARITHMETIC_END		/* $((...) */
+};
+
+static const char * input = NULL;
+static const char * inputEnd = NULL;
+static const char * cursor = NULL;
+static int lexState = LEX_INITIAL;
+
+/* token values go here, each followed by its terminator */
+static char * textBuffer = NULL;
+static char * textNext = NULL;
+
+static const char * arithStart = NULL;
+static int arithDepth = 0;
+static int arithReturn = LEX_INITIAL;
+
+
+/* parameterValue in parser.l, besides letters and digits */
+static const char wordPunctuation[] = "-\\+:._%?*~/,![]{}";
+
+
+static bool is_letter(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+
+static bool is_word_char(char c)
+{
+	return is_letter(c) || is_digit(c) ||
+		(c != '\0' && strchr(wordPunctuation, c) != NULL);
+}
+
+
+static bool is_name_char(char c)
+{
+	return is_letter(c) || is_digit(c) || c == '_';
+}
+
+
+#ifdef __SSE2__
+
+/* bytes of x in [lo, hi], with an unsigned comparison */
+static __m128i in_range(__m128i x, char lo, char hi)
+{
+	__m128i offset = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+	__m128i bias = _mm_set1_epi8((char)0x80);
+
+	return _mm_cmplt_epi8(_mm_xor_si128(offset, bias),
+		_mm_set1_epi8((char)((hi - lo + 1) ^ 0x80)));
+}
+
+
+/*
+ * bytes of x that are word characters: the letters (folded to lower
+ * case) and the ranges * to :, [ to ], } to ~, plus ! % ? _ {
+ */
+static int word_mask(__m128i x)
+{
+	__m128i m;
+
+	m = in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+	m = _mm_or_si128(m, in_range(x, '*', ':'));
+	m = _mm_or_si128(m, in_range(x, '[', ']'));
+	m = _mm_or_si128(m, in_range(x, '}', '~'));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('!')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('%')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('?')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('{')));
+
+	return _mm_movemask_epi8(m);
+}
+
+#endif
+
+
+/* end of the run of word characters starting at p */
+static const char * skip_word(const char * p)
+{
+#ifdef __SSE2__
+	int mask;
+
+	while (inputEnd - p >= 16) {
+		mask = word_mask(_mm_loadu_si128((const __m128i *)p));
+		if (mask != 0xffff)
+			return p + __builtin_ctz(~mask);
+		p += 16;
+	}
+#endif
+
+	while (p < inputEnd && is_word_char(*p))
+		p++;
+
+	return p;
+}
+
+
+/* first byte from p on that is one of a, b, c and d */
+static const char * find_any(const char * p, char a, char b, char c, char d)
+{
+#ifdef __SSE2__
+	__m128i va = _mm_set1_epi8(a);
+	__m128i vb = _mm_set1_epi8(b);
+	__m128i vc = _mm_set1_epi8(c);
+	__m128i vd = _mm_set1_epi8(d);
+	__m128i x;
+	int mask;
+
+	while (inputEnd - p >= 16) {
+		x = _mm_loadu_si128((const __m128i *)p);
+		mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, vc), _mm_cmpeq_epi8(x, vd))));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+
+	while (p < inputEnd && *p != a && *p != b && *p != c && *p != d)
+		p++;
+
+	return p;
+}
+
+
+static const char * save_text(const char * start, const char * end)
+{
+	char * text = textNext;
+
+	memcpy(text, start, end - start);
+	text[end - start] = '\0';
+	textNext += end - start + 1;
+
+	return text;
+}
+
+
+/* the lexeme [start, end) is matched and returned as token */
+static int match(const char * start, const char * end, int token)
+{
+	yylloc.first_column = start - input;
+	yylloc.last_column = end - input;
+	cursor = end;
+
+	return token;
+}
+
+
+static int match_text(const char * start, const char * end, int token)
+{
+	yylval.string_un = save_text(start, end);
+
+	return match(start, end, token);
+}
+
+
+/* the lexeme [start, end) is matched, but no token is returned */
+static void skip(const char * end)
+{
+	cursor = end;
+}
+
+
+/* {arithmeticStart}, {substitutionCharacter}{envVarName}, {substitutionCharacter} */
+static int lex_substitution(const char * p, int varToken)
+{
+	const char * end;
+
+	if (p[1] == '(' && p[2] == '(') {
+		arithStart = p + 3;
+		arithDepth = 0;
+		arithReturn = lexState;
+		lexState = LEX_ARITHMETIC;
+		skip(p + 3);
+		return 0;
+	}
+
+	if (!is_letter(p[1]) && p[1] != '_')
+		return match(p, p + 1, INVALID_ENVIRONMENT_VAR);
+
+	for (end = p + 2; end < inputEnd && is_name_char(*end); end++)
+		;
+	yylval.string_un = save_text(p + 1, end);
+
+	return match(p, end, varToken);
+}
+
+
+static int lex_initial(const char * p)
+{
+	const char * end;
+
+	if (p == inputEnd)
+		return END_OF_FILE;
+
+	switch (*p) {
+	case '\r':
+		if (p[1] != '\n')
+			return match(p, p + 1, NOT_ACCEPTED_CHAR);
+		end = p + 2;
+		/* {newLine}{anyChar}, {newLine} */
+		return end < inputEnd ? match(p, end + 1, CHARS_AFTER_EOL) :
+			match(p, end, END_OF_LINE);
+	case '\n':
+		end = p + 1;
+		return end < inputEnd ? match(p, end + 1, CHARS_AFTER_EOL) :
+			match(p, end, END_OF_LINE);
+	case '\'':
+		lexState = LEX_ACCEPT_ANY;
+		skip(p + 1);
+		return 0;
+	case '"':
+		lexState = LEX_ACCEPT_ANY_AND_EXPANSION;
+		skip(p + 1);
+		return 0;
+	case ';':
+		return match(p, p + 1, SEQUENTIAL);
+	case '|':
+		if (p[1] == '|')
+			return match(p, p + 2, CONDITIONAL_NZERO);
+		return match(p, p + 1, PIPE);
+	case '&':
+		if (p[1] == '&')
+			return match(p, p + 2, CONDITIONAL_ZERO);
+		if (p[1] == '>')
+			return match(p, p + 2, REDIRECT_OE);
+		return match(p, p + 1, PARALLEL);
+	case '2':
+		if (p[1] != '>')
+			break;
+		if (p[2] == '>')
+			return match(p, p + 3, REDIRECT_APPEND_E);
+		return match(p, p + 2, REDIRECT_E);
+	case '>':
+		if (p[1] == '>')
+			return match(p, p + 2, REDIRECT_APPEND_O);
+		return match(p, p + 1, REDIRECT_O);
+	case '<':
+		return match(p, p + 1, INDIRECT);
+	case ' ':
+	case '\t':
+		for (end = p + 1; *end == ' ' || *end == '\t'; end++)
+			;
+		return match(p, end, BLANK);
+	case '=':
+		return match_text(p, p + 1, WORD);
+	case '$':
+		return lex_substitution(p, ENV_VAR);
+	}
+
+	/* {parameterValue}, {anyChar} */
+	end = skip_word(p);
+	if (end == p)
+		return match(p, p + 1, NOT_ACCEPTED_CHAR);
+
+	return match_text(p, end, WORD);
+}
+
+
+static int lex_accept_any(const char * p)
+{
+	const char * end;
+
+	if (p == inputEnd)
+		return UNEXPECTED_EOF;
+
+	if (*p == '\'') {
+		lexState = LEX_INITIAL;
+		skip(p + 1);
+		return 0;
+	}
+
+	/* {allButCharStateAny}* */
+	end = find_any(p, '\'', '\'', '\'', '\'');
+	return match_text(p, end, QUOTED_WORD);
+}
+
+
+static int lex_accept_any_and_expansion(const char * p)
+{
+	const char * end;
+
+	if (p == inputEnd)
+		return UNEXPECTED_EOF;
+
+	if (*p == '"') {
+		lexState = LEX_INITIAL;
+		skip(p + 1);
+		return 0;
+	}
+
+	if (*p == '$')
+		return lex_substitution(p, QUOTED_ENV_VAR);
+
+	/* {allButCharStateAnyAndExpansion}* */
+	end = find_any(p, '"', '$', '"', '$');
+	return match_text(p, end, QUOTED_WORD);
+}
+
+
+static int lex_arithmetic(const char * p)
+{
+	if (p == inputEnd)
+		return UNEXPECTED_EOF;
+
+	switch (*p) {
+	case '(':
+		arithDepth++;
+		skip(p + 1);
+		return 0;
+	case ')':
+		if (arithDepth == 0)
+			lexState = LEX_ARITHMETIC_END;
+		else
+			arithDepth--;
+		skip(p + 1);
+		return 0;
+	case '\r':
+	case '\n':
+		return match(p, p + 1, NOT_ACCEPTED_CHAR);
+	}
+
+	/* {arithmeticChars}+ */
+	skip(find_any(p, '(', ')', '\r', '\n'));
+	return 0;
+}
+
+
+static int lex_arithmetic_end(const char * p)
+{
+	if (p == inputEnd)
+		return UNEXPECTED_EOF;
+
+	if (*p != ')')
+		return match(p, p + 1, NOT_ACCEPTED_CHAR);
+
+	/* the expression ends before the first of the two parentheses */
+	yylval.string_un = save_text(arithStart, p - 1);
+	lexState = arithReturn;
+
+	return match(p, p + 1, arithReturn == LEX_ACCEPT_ANY_AND_EXPANSION ?
+		QUOTED_ARITH_EXPR : ARITH_EXPR);
+}
+
+
+void fastParseAnotherString(const char * str)
+{
+	size_t length = strlen(str);
+
+	input = cursor = str;
+	inputEnd = str + length;
+	lexState = LEX_INITIAL;
+
+	/* every token is at least a byte long and gets a terminator */
+	textBuffer = (char *) malloc(2 * length + 1);
+	pointerToMallocMemory(textBuffer);
+	textNext = textBuffer;
+}
+
+
+int fastLex(void)
+{
+	int token;
+
+	do {
+		switch (lexState) {
+		case LEX_ACCEPT_ANY:
+			token = lex_accept_any(cursor);
+			break;
+		case LEX_ACCEPT_ANY_AND_EXPANSION:
+			token = lex_accept_any_and_expansion(cursor);
+			break;
+		case LEX_ARITHMETIC:
+			token = lex_arithmetic(cursor);
+			break;
+		case LEX_ARITHMETIC_END:
+			token = lex_arithmetic_end(cursor);
+			break;
+		default:
+			token = lex_initial(cursor);
+			break;
+		}
+	} while (token == 0);
+
+	return token;
+}
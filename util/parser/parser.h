@@ -29,11 +29,15 @@
  * if (flag) ...
  * else      ...
  *
+ * It takes one byte, like the C++ bool, so that structures such as
+ * word_t have the same layout in the C parser and in C++ code using it
  */
-typedef enum {
+typedef unsigned char bool;
+
+enum {
 	false,
 	true
-} bool;
+};
 #endif
 
 
@@ -47,6 +51,15 @@ typedef enum {
  * Some parts might need environment variable expansion (expand == true);
  * if that is the case, "string" points to the environment variable name
 
+ * Parts that come from an arithmetic expansion $((...)) have
+ * arith == true and "string" points to the expression between the
+ * parentheses; it is evaluated each time the word is expanded
+
+ * Parts that come from a quoted string ('...' or "...") have
+ * quoted == true; their contents must not undergo pathname expansion
+ * (globbing), while unquoted parts may contain the *, ? and [...]
+ * wildcards
+
  * The next string literal is pointed to by next_word
  * (NULL if there are no more list elements)
 
@@ -65,6 +78,8 @@ typedef enum {
 typedef struct word_t {
 	const char *string;
 	bool expand;
+	bool quoted;
+	bool arith;
 	struct word_t *next_part;
 	struct word_t *next_word;
 } word_t;
@@ -122,6 +137,12 @@ typedef struct {
  * OP_NONE means no operator
  * (the scmd field points to a simple command and cmd1 == cmd2 == NULL)
 
+ * OP_FOR is a loop (for name in words; do cmd1; done): scmd->verb is
+ * the name of the variable, scmd->params the words it takes in turn,
+ * cmd1 the body and cmd2 == NULL
+
+ * OP_WHILE is a loop (while cmd1; do cmd2; done)
+
  * The rest of the operators mean scmd == NULL
 
  * OP_DUMMY is a dummy value that can be used to count the number of operators
@@ -134,6 +155,8 @@ typedef enum {
 	OP_CONDITIONAL_ZERO,
 	OP_CONDITIONAL_NZERO,
 	OP_PIPE,
+	OP_FOR,
+	OP_WHILE,
 	OP_DUMMY
 } operator_t;
 
@@ -145,6 +168,10 @@ typedef enum {
       scmd != NULL
       cmd1 == cmd2 == NULL
       scmd points to a command to be executed
+ *  else if (op == OP_FOR)
+      scmd != NULL
+      cmd1 != NULL
+      cmd2 == NULL
  *  else
       scmd == NULL
       cmd1 != NULL
@@ -158,7 +185,7 @@ typedef enum {
  * The root of the tree has up == NULL
 
  * The parsed expressions do not contain parantheses, this means that
- * the following holds:
+ * the following holds (the body and condition of a loop start over):
  * for any op_lower that has a lower priority than op, there is no
  * parent in the tree with op == op_lower
  * In particular, if op == OP_PIPE descendants
@@ -198,6 +225,10 @@ void parse_error(const char *str, const int where);
  * The line must end with "\r\n\0" or "\n\0" or "\0"
  * (*root) must point to NULL ((*root) == NULL)
 
+ * The line is split in tokens by the lexer in fastlex.c, or by the flex
+ * lexer generated from parser.l if the MINISHELL_LEXER environment
+ * variable is "flex"; both produce the same tokens
+
  * parse_line returns true if there was no error parsing the line
  * and false if there was an error parsing or the arguments were invalid
 
@@ -216,6 +247,22 @@ bool parse_line(const char *line, command_t **root);
 
 void free_parse_memory(void);
 
+
+/*
+ * The parser keeps a single parse tree; call save_parse_memory() to
+ * parse another line while the current tree is still in use (e.g. from
+ * an internal command)
+
+ * the tree stays valid until the matching restore_parse_memory(), which
+ * frees the lines parsed in between and makes the saved tree the
+ * current one again
+ */
+
+typedef struct parse_memory parse_memory_t;
+
+parse_memory_t *save_parse_memory(void);
+void restore_parse_memory(parse_memory_t *mem);
+
 #ifdef __cplusplus
 }
 #endif
@@ -229,10 +276,20 @@ void free_parse_memory(void);
 
 typedef void *GenericPointer;
 
+/*
+ * A list under construction: last is the element appends start from,
+ * so building a list is linear in its length
+ */
+
+typedef struct {
+	word_t *first;
+	word_t *last;
+} word_list_t;
+
 typedef struct {
-	word_t *red_i;
-	word_t *red_o;
-	word_t *red_e;
+	word_list_t red_i;
+	word_list_t red_o;
+	word_list_t red_e;
 	int red_flags;
 } redirect_t;
 
@@ -246,6 +303,8 @@ void pointerToMallocMemory(const void *ptr);
 int yylex(void);
 void globalParseAnotherString(const char *str);
 void globalEndParsing(void);
+void fastParseAnotherString(const char *str);
+int fastLex(void);
 
 #ifdef __cplusplus
 }
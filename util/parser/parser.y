@@ -42,6 +42,10 @@ static command_t * command_root = NULL;
 
 void yyerror(const char* str);
 
+/* the parser reads its tokens through the keyword recognizer */
+static int keyword_lex(void);
+#define yylex keyword_lex
+
 
 static void ensureSize(size_t newSize)
 {
@@ -98,9 +102,9 @@ static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirec
 	assert(exe_name->next_word == NULL);
 	s->verb = exe_name;
 	s->params = params;
-	s->in = red.red_i;
-	s->out = red.red_o;
-	s->err = red.red_e;
+	s->in = red.red_i.first;
+	s->out = red.red_o.first;
+	s->err = red.red_e.first;
 	s->io_flags = red.red_flags;
 	s->up = NULL;
 	s->aux = NULL;
@@ -154,7 +158,25 @@ static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t
 }
 
 
-static word_t * new_word(const char * str, bool expand)
+static command_t * new_for(word_t * name, word_t * items, command_t * body)
+{
+	redirect_t red;
+	command_t * c;
+
+	memset(&red, 0, sizeof(red));
+	c = new_command(bind_parts(name, items, red));
+
+	assert(body != NULL);
+	assert(body->up == NULL);
+	c->op = OP_FOR;
+	c->cmd1 = body;
+	body->up = c;
+
+	return c;
+}
+
+
+static word_t * new_word(const char * str, bool expand, bool quoted)
 {
 	word_t * w = (word_t *) malloc(sizeof(word_t));
 	pointerToMallocMemory(w);
@@ -163,6 +185,7 @@ static word_t * new_word(const char * str, bool expand)
 	assert(str != NULL);
 	w->string = str;
 	w->expand = expand;
+	w->quoted = quoted;
 	w->next_part = NULL;
 	w->next_word = NULL;
 
@@ -170,53 +193,52 @@ static word_t * new_word(const char * str, bool expand)
 }
 
 
-static word_t * add_part_to_word(word_t * w, word_t * lst)
+static word_t * new_arith(const char * str, bool quoted)
 {
-	word_t * crt = lst;
-	assert(lst != NULL);
-	assert(w != NULL);
+	word_t * w = new_word(str, false, quoted);
 
-	/*
-	 we could insert at the beginnig and then invert the list
-	 but this would make the code a bit more complicated
-	 thus, we assume we have small lists and O(n*n) is acceptable
-	*/
+	w->arith = true;
+
+	return w;
+}
 
-	while (crt->next_part != NULL) {
-		crt = crt->next_part;
-		assert((crt == NULL) || (crt->next_word == NULL));
-	}
 
-	crt->next_part = w;
+static void add_part_to_word(word_t * w, word_list_t * lst)
+{
+	assert(lst->first != NULL);
+	assert(lst->last->next_part == NULL);
+	assert(w != NULL);
 	assert(w->next_part == NULL);
 	assert(w->next_word == NULL);
 
-	return lst;
+	lst->last->next_part = w;
+	lst->last = w;
 }
 
 
-static word_t * add_word_to_list(word_t * w, word_t * lst)
+static void add_word_to_list(word_t * w, word_list_t * lst)
 {
-	word_t * crt = lst;
 	assert(w != NULL);
 
-	if (crt == NULL) {
+	if (lst->first == NULL) {
 		assert(w->next_word == NULL);
-		return w;
+		lst->first = lst->last = w;
+		return;
 	}
-	assert(lst != NULL);
 
 	/*
-	 same as above
+	 the word given to "&>" is in both the out and the err lists, so
+	 appending to one of them may have extended the other one
 	*/
-	while (crt->next_word != NULL) {
-		crt = crt->next_word;
-	}
+	while (lst->last->next_word != NULL && lst->last != w)
+		lst->last = lst->last->next_word;
 
-	crt->next_word = w;
-	assert(w->next_word == NULL);
+	if (lst->last == w)
+		return;
 
-	return lst;
+	assert(w->next_word == NULL);
+	lst->last->next_word = w;
+	lst->last = w;
 }
 
 
@@ -228,8 +250,8 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 	redirect_t redirect_un;
 	simple_command_t * simple_command_un;
 	word_t * exe_un;
-	word_t * params_un;
-	word_t * word_un;
+	word_list_t params_un;
+	word_list_t word_un;
 }
 
 
@@ -245,7 +267,22 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 %left CONDITIONAL_NZERO CONDITIONAL_ZERO
 %left PIPE
 
+/*
+ * declared after the operators so the values of the tokens above
+ * do not change
+ */
+%token <string_un> QUOTED_WORD
+%token <string_un> QUOTED_ENV_VAR
+
+/* keywords, produced by keyword_lex() and not by the lexer */
+%token FOR IN DO DONE WHILE
+
+/* arithmetic expansion $((...)), the value is the expression */
+%token <string_un> ARITH_EXPR
+%token <string_un> QUOTED_ARITH_EXPR
+
 %type <command_un> command
+%type <command_un> loop
 %type <exe_un> exe_name
 %type <params_un> params
 %type <redirect_un> redirect
@@ -316,16 +353,40 @@ command:
 		$$ = bind_commands($1, $3, OP_PIPE);
 	}
 
+	| loop {
+		$$ = $1;
+	}
+
+	;
+
+loop:
+
+	  FOR WORD IN params SEQUENTIAL DO command SEQUENTIAL DONE {
+		$$ = new_for(new_word($2, false, false), $4.first, $7);
+	}
+
+	| FOR WORD IN params BLANK SEQUENTIAL DO command SEQUENTIAL DONE {
+		$$ = new_for(new_word($2, false, false), $4.first, $8);
+	}
+
+	| FOR WORD IN SEQUENTIAL DO command SEQUENTIAL DONE {
+		$$ = new_for(new_word($2, false, false), NULL, $6);
+	}
+
+	| WHILE command SEQUENTIAL DO command SEQUENTIAL DONE {
+		$$ = bind_commands($2, $5, OP_WHILE);
+	}
+
 	;
 
 simple_command:
 
 	  exe_name BLANK params redirect {
-		$$ = bind_parts($1, $3, $4);
+		$$ = bind_parts($1, $3.first, $4);
 	}
 
 	| exe_name BLANK params BLANK redirect {
-		$$ = bind_parts($1, $3, $5);
+		$$ = bind_parts($1, $3.first, $5);
 	}
 
 	| exe_name redirect {
@@ -341,11 +402,11 @@ simple_command:
 exe_name:
 
 	  word {
-		$$ = $1;
+		$$ = $1.first;
 	}
 
 	| BLANK word {
-		$$ = $2;
+		$$ = $2.first;
 	}
 
 	;
@@ -353,152 +414,152 @@ exe_name:
 params:
 
 	  params BLANK word {
-		$$ = add_word_to_list($3, $1);
-		assert($$ == $1);
+		add_word_to_list($3.first, &$1);
+		$$ = $1;
 	}
 
 	| word {
-		$$ = $1;
+		$$.first = $$.last = $1.first;
 	}
 	;
 
 redirect:
 
 	  { /* empty */
-		$$.red_o = NULL;
-		$$.red_i = NULL;
-		$$.red_e = NULL;
+		$$.red_o.first = $$.red_o.last = NULL;
+		$$.red_i.first = $$.red_i.last = NULL;
+		$$.red_e.first = $$.red_e.last = NULL;
 		$$.red_flags = IO_REGULAR;
 	}
 
 	| redirect REDIRECT_OE word {
-		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		add_word_to_list($3.first, &$1.red_o);
+		add_word_to_list($3.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E word {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		add_word_to_list($3.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O word {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		add_word_to_list($3.first, &$1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E word {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		add_word_to_list($3.first, &$1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O word {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		add_word_to_list($3.first, &$1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT word {
-		$1.red_i = add_word_to_list($3, $1.red_i);
+		add_word_to_list($3.first, &$1.red_i);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_OE word BLANK {
-		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		add_word_to_list($3.first, &$1.red_o);
+		add_word_to_list($3.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E word BLANK {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		add_word_to_list($3.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O word BLANK {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		add_word_to_list($3.first, &$1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E word BLANK {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		add_word_to_list($3.first, &$1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O word BLANK {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		add_word_to_list($3.first, &$1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT word BLANK {
-		$1.red_i = add_word_to_list($3, $1.red_i);
+		add_word_to_list($3.first, &$1.red_i);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_OE BLANK word {
-		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		add_word_to_list($4.first, &$1.red_o);
+		add_word_to_list($4.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E BLANK word {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		add_word_to_list($4.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O BLANK word {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		add_word_to_list($4.first, &$1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E BLANK word {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		add_word_to_list($4.first, &$1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O BLANK word {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		add_word_to_list($4.first, &$1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT BLANK word {
-		$1.red_i = add_word_to_list($4, $1.red_i);
+		add_word_to_list($4.first, &$1.red_i);
 		$$ = $1;
 	}
 	| redirect REDIRECT_OE BLANK word BLANK {
-		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		add_word_to_list($4.first, &$1.red_o);
+		add_word_to_list($4.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E BLANK word BLANK {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		add_word_to_list($4.first, &$1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O BLANK word BLANK {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		add_word_to_list($4.first, &$1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O BLANK word BLANK {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		add_word_to_list($4.first, &$1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E BLANK word BLANK {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		add_word_to_list($4.first, &$1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT BLANK word BLANK {
-		$1.red_i = add_word_to_list($4, $1.red_i);
+		add_word_to_list($4.first, &$1.red_i);
 		$$ = $1;
 	}
 
@@ -507,25 +568,224 @@ redirect:
 word:
 
 	  word WORD {
-		$$ = add_part_to_word(new_word($2, false), $1);
+		add_part_to_word(new_word($2, false, false), &$1);
+		$$ = $1;
 	}
 
 	| word ENV_VAR {
-		$$ = add_part_to_word(new_word($2, true), $1);
+		add_part_to_word(new_word($2, true, false), &$1);
+		$$ = $1;
+	}
+
+	| word QUOTED_WORD {
+		add_part_to_word(new_word($2, false, true), &$1);
+		$$ = $1;
+	}
+
+	| word QUOTED_ENV_VAR {
+		add_part_to_word(new_word($2, true, true), &$1);
+		$$ = $1;
+	}
+
+	| word ARITH_EXPR {
+		add_part_to_word(new_arith($2, false), &$1);
+		$$ = $1;
+	}
+
+	| word QUOTED_ARITH_EXPR {
+		add_part_to_word(new_arith($2, true), &$1);
+		$$ = $1;
 	}
 
 	| WORD {
-		$$ = new_word($1, false);
+		$$.first = $$.last = new_word($1, false, false);
 	}
 
 	| ENV_VAR {
-		$$ = new_word($1, true);
+		$$.first = $$.last = new_word($1, true, false);
+	}
+
+	| QUOTED_WORD {
+		$$.first = $$.last = new_word($1, false, true);
+	}
+
+	| QUOTED_ENV_VAR {
+		$$.first = $$.last = new_word($1, true, true);
+	}
+
+	| ARITH_EXPR {
+		$$.first = $$.last = new_arith($1, false);
+	}
+
+	| QUOTED_ARITH_EXPR {
+		$$.first = $$.last = new_arith($1, true);
 	}
 
 	;
 %%
 
 
+/*
+ * Keywords are plain words for the lexer; keyword_lex() turns them into
+ * tokens where they can appear: for, while, do and done at the start of
+ * a command and in after the variable of a for. A keyword must be a
+ * whole unquoted word (done=1 is an assignment). Blanks next to keywords
+ * are dropped, so the grammar does not have to allow them everywhere.
+ */
+
+#undef yylex
+
+#define MAX_QUEUED_TOKENS	4
+
+typedef struct {
+	int token;
+	YYSTYPE value;
+	YYLTYPE location;
+} queued_token_t;
+
+/* read the tokens with the flex lexer instead of fastlex.c */
+static bool useFlex = false;
+
+static queued_token_t queuedTokens[MAX_QUEUED_TOKENS];
+static int queuedCount = 0;
+static bool commandStart = true;
+static bool afterKeyword = false;
+/* 1 after for, 2 after the variable name */
+static int forState = 0;
+/*
+ * where the lexer is; yylloc is rewound to the token handed to the
+ * parser, while the flex lexer counts from the previous one it read
+ */
+static YYLTYPE lexLocation;
+
+
+static void reset_keywords(void)
+{
+	queuedCount = 0;
+	commandStart = true;
+	afterKeyword = false;
+	forState = 0;
+	lexLocation.first_line = lexLocation.last_line = 1;
+	lexLocation.first_column = lexLocation.last_column = 0;
+}
+
+
+static queued_token_t * peek_token(int i)
+{
+	assert(i < MAX_QUEUED_TOKENS);
+
+	while (queuedCount <= i) {
+		yylloc = lexLocation;
+		queuedTokens[queuedCount].token = useFlex ? yylex() : fastLex();
+		queuedTokens[queuedCount].value = yylval;
+		queuedTokens[queuedCount].location = lexLocation = yylloc;
+		queuedCount++;
+	}
+
+	return &queuedTokens[i];
+}
+
+
+static bool is_word_part(int token)
+{
+	return token == WORD || token == ENV_VAR ||
+		token == QUOTED_WORD || token == QUOTED_ENV_VAR ||
+		token == ARITH_EXPR || token == QUOTED_ARITH_EXPR;
+}
+
+
+static bool is_keyword(int token)
+{
+	return token == FOR || token == IN || token == DO ||
+		token == DONE || token == WHILE;
+}
+
+
+/* classify the i-th queued token, in the current context */
+static int classify_token(int i)
+{
+	queued_token_t * t = peek_token(i);
+	const char * str;
+
+	if (t->token != WORD || is_word_part(peek_token(i + 1)->token))
+		return t->token;
+
+	str = t->value.string_un;
+	if (forState == 2)
+		return strcmp(str, "in") == 0 ? IN : WORD;
+	if (!commandStart || forState != 0)
+		return WORD;
+
+	if (strcmp(str, "for") == 0)
+		return FOR;
+	if (strcmp(str, "while") == 0)
+		return WHILE;
+	if (strcmp(str, "do") == 0)
+		return DO;
+	if (strcmp(str, "done") == 0)
+		return DONE;
+
+	return WORD;
+}
+
+
+static int keyword_lex(void)
+{
+	int token = classify_token(0);
+
+	while (token == BLANK && (afterKeyword || is_keyword(classify_token(1)))) {
+		queuedCount--;
+		memmove(queuedTokens, queuedTokens + 1, queuedCount * sizeof(queued_token_t));
+		token = classify_token(0);
+	}
+
+	yylval = queuedTokens[0].value;
+	yylloc = queuedTokens[0].location;
+	queuedCount--;
+	memmove(queuedTokens, queuedTokens + 1, queuedCount * sizeof(queued_token_t));
+
+	if (token == BLANK)
+		return token;
+
+	afterKeyword = is_keyword(token);
+
+	switch (token) {
+	case SEQUENTIAL:
+	case PARALLEL:
+	case CONDITIONAL_ZERO:
+	case CONDITIONAL_NZERO:
+	case PIPE:
+	case DO:
+	case WHILE:
+		commandStart = true;
+		forState = 0;
+		break;
+	case FOR:
+		commandStart = false;
+		forState = 1;
+		break;
+	default:
+		commandStart = false;
+		if (forState == 1 && token == WORD)
+			forState = 2;
+		else if (!is_word_part(token))
+			forState = 0;
+		break;
+	}
+
+	return token;
+}
+
+
+/* MINISHELL_LEXER=flex selects the flex lexer */
+static bool is_flex_selected(void)
+{
+	const char * lexer = getenv("MINISHELL_LEXER");
+
+	return lexer != NULL && strcmp(lexer, "flex") == 0;
+}
+
+
 bool parse_line(const char * line, command_t ** root)
 {
 	if (*root != NULL) {
@@ -541,9 +801,14 @@ bool parse_line(const char * line, command_t ** root)
 	}
 
 	free_parse_memory();
-	globalParseAnotherString(line);
+	useFlex = is_flex_selected();
+	if (useFlex)
+		globalParseAnotherString(line);
+	else
+		fastParseAnotherString(line);
 	needsFree = true;
 	command_root = NULL;
+	reset_keywords();
 
 	yylloc.first_line = yylloc.last_line = 1;
 	yylloc.first_column = yylloc.last_column = 0;
@@ -581,6 +846,52 @@ void free_parse_memory()
 }
 
 
+struct parse_memory {
+	GenericPointer * allocMem;
+	size_t allocCount;
+	size_t allocSize;
+	bool needsFree;
+};
+
+
+parse_memory_t * save_parse_memory()
+{
+	parse_memory_t * mem = (parse_memory_t *) malloc(sizeof(parse_memory_t));
+	if (mem == NULL) {
+		fprintf(stderr, "malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* the lexer is done with the saved line, only the tree is kept */
+	globalEndParsing();
+
+	mem->allocMem = globalAllocMem;
+	mem->allocCount = globalAllocCount;
+	mem->allocSize = globalAllocSize;
+	mem->needsFree = needsFree;
+
+	globalAllocMem = NULL;
+	globalAllocCount = 0;
+	globalAllocSize = 0;
+	needsFree = false;
+
+	return mem;
+}
+
+
+void restore_parse_memory(parse_memory_t * mem)
+{
+	free_parse_memory();
+
+	globalAllocMem = mem->allocMem;
+	globalAllocCount = mem->allocCount;
+	globalAllocSize = mem->allocSize;
+	needsFree = mem->needsFree;
+
+	free(mem);
+}
+
+
 void yyerror(const char* str)
 {
 	parse_error(str, yylloc.first_column);
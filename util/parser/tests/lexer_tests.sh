@@ -0,0 +1,33 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Parse every test file with the default lexer (fastlex.c) and with the
+# flex one (MINISHELL_LEXER=flex); the parse trees and the errors must
+# be the same.
+#
+# Run from the tests directory, after building the parser:
+#   ./lexer_tests.sh [../DisplayStructure]
+
+DISPLAY="${1:-../DisplayStructure}"
+
+fast=$(mktemp)
+flex=$(mktemp)
+trap 'rm -f "$fast" "$flex"' EXIT
+
+failed=0
+
+for input in *.txt; do
+	"$DISPLAY" < "$input" > "$fast" 2>&1
+	MINISHELL_LEXER=flex "$DISPLAY" < "$input" > "$flex" 2>&1
+
+	if ! diff -u "$flex" "$fast" > /dev/null; then
+		echo "$input: the lexers differ"
+		diff -u --label flex --label fastlex "$flex" "$fast" | head -20
+		failed=1
+		continue
+	fi
+
+	echo "$input: ok"
+done
+
+exit $failed
@@ -0,0 +1,56 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Parse commands with huge argument lists and words made of many parts;
+# parsing must stay linear, so each line gets a fixed time budget.
+#
+# Run from the tests directory, after building the parser:
+#   ./stress_tests.sh [../DisplayStructure]
+
+DISPLAY="${1:-../DisplayStructure}"
+TIME_LIMIT=10
+
+input=$(mktemp)
+output=$(mktemp)
+trap 'rm -f "$input" "$output"' EXIT
+
+failed=0
+
+# check NAME EXPECTED_COUNT PATTERN: parse $input and count the elements
+check()
+{
+	local start end count
+
+	start=$(date +%s%N)
+	if ! timeout "$TIME_LIMIT" "$DISPLAY" < "$input" > "$output" 2>&1; then
+		echo "$1: timed out or failed"
+		failed=1
+		return
+	fi
+	end=$(date +%s%N)
+
+	count=$(grep -o -- "$3" "$output" | wc -l)
+	if [ "$count" -ne "$2" ]; then
+		echo "$1: expected $2 elements, got $count"
+		failed=1
+		return
+	fi
+
+	echo "$1: ok ($(( (end - start) / 1000000 )) ms)"
+}
+
+for n in 100000 1000000; do
+	seq 1 "$n" | sed "s/^/arg/" | tr '\n' ' ' | sed 's/^/echo /' > "$input"
+	echo >> "$input"
+	check "$n arguments" "$n" "'arg[0-9]*'"
+
+	seq 1 "$n" | sed "s/^/part/" | tr '\n' '=' | sed 's/^/echo /' > "$input"
+	echo >> "$input"
+	check "$n word parts" "$n" "'='"
+
+	seq 1 "$n" | sed "s/^/> out/" | tr '\n' ' ' | sed 's/^/echo /' > "$input"
+	echo >> "$input"
+	check "$n redirections" "$n" "'out[0-9]*'"
+done
+
+exit $failed